@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""Generate request bodies for bench/run.sh.
+
+Bodies are JSON records from a fixed seed, so every run posts the same
+bytes.  Usage: gen.py OUTDIR
+"""
+
+import gzip
+import json
+import os
+import random
+import sys
+
+
+def records(size, seed):
+    rnd = random.Random(seed)
+    words = ["alpha", "bravo", "charlie", "delta", "echo", "foxtrot",
+             "golf", "hotel", "india", "juliet", "kilo", "lima"]
+    out = []
+    n = 0
+    i = 0
+    while n < size:
+        rec = json.dumps({
+            "id": i,
+            "name": " ".join(rnd.choice(words) for _ in range(3)),
+            "score": rnd.randint(0, 100000),
+            "tags": rnd.sample(words, 4),
+            "active": rnd.random() < 0.5,
+        })
+        out.append(rec)
+        n += len(rec) + 2
+        i += 1
+    return ("[" + ",\n".join(out) + "]").encode()
+
+
+def write(path, data):
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+def main():
+    outdir = sys.argv[1]
+    os.makedirs(outdir, exist_ok=True)
+
+    sizes = {"1K": 1024, "40K": 40 * 1024, "100K": 100 * 1024,
+             "1M": 1024 * 1024, "50M": 50 * 1024 * 1024}
+
+    for name, size in sizes.items():
+        raw = records(size, seed=size)
+        write(os.path.join(outdir, name + ".json"), raw)
+        write(os.path.join(outdir, name + ".json.gz"),
+              gzip.compress(raw, compresslevel=6, mtime=0))
+
+    raw = records(sizes["1M"], seed=sizes["1M"])
+
+    for level in (1, 9):
+        write(os.path.join(outdir, "1M-l%d.json.gz" % level),
+              gzip.compress(raw, compresslevel=level, mtime=0))
+
+    # four gzip members, as written by "cat a.gz b.gz ..."
+    quarter = len(raw) // 4
+    members = b"".join(
+        gzip.compress(raw[i * quarter:(i + 1) * quarter if i < 3 else None],
+                      compresslevel=6, mtime=0)
+        for i in range(4))
+    write(os.path.join(outdir, "1M-multi.json.gz"), members)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# Build the body filter microbenchmark with objects of a built nginx,
+# see doc/benchmark.md.
+#
+# usage: bench/micro/build.sh /path/to/nginx-source
+#
+# environment:
+#   CONFIGURE   extra options for auto/configure, used when the tree is not
+#               configured with this module yet
+#
+# The module is compiled into the driver, so nginx's own copy of it is left
+# out, and main() of nginx is renamed away with objcopy.  GNU ld is needed
+# for --wrap.
+
+set -e
+
+NGINX_SRC=${1:?usage: $0 /path/to/nginx-source}
+
+MICRO=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(cd "$MICRO/../.." && pwd)
+
+cd "$NGINX_SRC"
+
+if ! grep -q ngx_http_gunzip_request_module objs/ngx_modules.c 2>/dev/null
+then
+    ./auto/configure --with-threads --add-module="$ROOT" $CONFIGURE
+fi
+
+make -f objs/Makefile
+
+# compiler and flags as nginx itself is built with
+
+cat > objs/gunzip_request_micro.mk << 'END'
+include objs/Makefile
+micro-%:
+	@echo $($*)
+END
+
+CC=$(make -s -f objs/gunzip_request_micro.mk micro-CC)
+CFLAGS=$(make -s -f objs/gunzip_request_micro.mk micro-CFLAGS)
+INCS=$(make -s -f objs/gunzip_request_micro.mk micro-ALL_INCS)
+
+# objects and libraries from the link command of objs/nginx
+
+LINK=$(awk '/\$\(LINK\) -o objs\/nginx/ { f = 1 }
+            f { print; if ($0 !~ /\\$/) exit }' objs/Makefile | tr -d '\\')
+
+OBJS=
+LIBS=
+
+for t in $LINK; do
+    case $t in
+        '$(LINK)' | -o | objs/nginx)
+            ;;
+        */ngx_http_gunzip_request_module.o)
+            ;;
+        objs/src/core/nginx.o)
+            OBJS="$OBJS objs/gunzip_request_micro_nginx.o"
+            ;;
+        *.o)
+            OBJS="$OBJS $t"
+            ;;
+        *)
+            LIBS="$LIBS $t"
+            ;;
+    esac
+done
+
+objcopy --redefine-sym main=ngx_gunzip_request_micro_unused_main \
+    objs/src/core/nginx.o objs/gunzip_request_micro_nginx.o
+
+$CC -c $CFLAGS $INCS -I "$ROOT" \
+    -o objs/gunzip_request_micro.o "$MICRO/micro.c"
+
+$CC -o objs/gunzip_request_micro objs/gunzip_request_micro.o $OBJS $LIBS \
+    -Wl,--wrap=ngx_http_finalize_request \
+    -Wl,--wrap=ngx_http_discard_request_body
+
+echo "$NGINX_SRC/objs/gunzip_request_micro"
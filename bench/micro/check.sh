@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+# Run bench/micro cases which must inflate the whole body, and fail with
+# the first one which does not, see doc/benchmark.md.
+#
+# usage: bench/micro/check.sh /path/to/nginx-source [cases...]
+#
+# environment:
+#   WORK        work directory for test data (bench/work)
+
+set -e
+
+NGINX_SRC=${1:?usage: $0 /path/to/nginx-source [cases...]}
+shift
+
+MICRO=$(cd "$(dirname "$0")" && pwd)
+BENCH=$(dirname "$MICRO")
+WORK=${WORK:-$BENCH/work}
+DATA=$WORK/data
+BIN=$NGINX_SRC/objs/gunzip_request_micro
+
+# name body options
+CASES="
+BACKPRESSURE     1M.json.gz    -u -x -b 4,4096 -s 0,4096,65536
+BACKPRESSURE-L1  1M-l1.json.gz -u -x -b 4,4096 -s 4096 -f 4
+SINGLE-OVERFLOW  100K.json.gz  -w -o -b 32,4096 -s 0,4096,16384
+"
+
+if [ ! -x "$BIN" ]; then
+    "$MICRO/build.sh" "$NGINX_SRC" > /dev/null
+fi
+
+python3 "$BENCH/gen.py" "$DATA"
+
+echo "$CASES" | while read -r name body options; do
+    [ -z "$name" ] && continue
+
+    if [ $# -gt 0 ]; then
+        case " $* " in *" $name "*) ;; *) continue ;; esac
+    fi
+
+    # shellcheck disable=SC2086
+    if "$BIN" -i "$DATA/$body" -n 10 $options > /dev/null; then
+        echo "ok      $name"
+    else
+        echo "FAILED  $name: gunzip_request_micro -i $body $options"
+        exit 1
+    fi
+done
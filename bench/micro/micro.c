@@ -0,0 +1,702 @@
+
+/*
+ * Microbenchmark of the request body filter out of nginx event loop.
+ *
+ * The module is compiled into this driver and linked with objects of a
+ * built nginx, see build.sh.  A compressed body is passed to the body
+ * filter as a chain of buffers split at given sizes, as nginx passes each
+ * read from a client, and the next filter consumes inflated buffers at
+ * once.  No connection, event loop or upstream is involved.
+ */
+
+
+#include "ngx_http_gunzip_request_module.c"
+
+#include <stdio.h>
+#include <time.h>
+
+
+#define MICRO_POOL_SIZE    4096
+
+#define MICRO_USAGE                                                           \
+    "usage: gunzip_request_micro -i file [-n requests] [-s split,...]\n"      \
+    "           [-c coding] [-e engine] [-b num,size] [-f every] [-l]\n"      \
+    "           [-u] [-x] [-a] [-o] [-w] [-k] [-r ratio] [-p pool_size]\n"
+
+
+typedef struct {
+    u_char              *data;
+    size_t               len;
+
+    ngx_str_t            coding;
+    ngx_uint_t           requests;
+    ngx_uint_t           flush_every;
+    unsigned             last_apart:1;
+    unsigned             unknown_length:1;
+    unsigned             no_buffering:1;
+} micro_conf_t;
+
+
+typedef struct {
+    ngx_uint_t           calls;
+    ngx_uint_t           links;
+    ngx_uint_t           bufs;
+    ngx_uint_t           pool_blocks;
+    ngx_uint_t           pool_large;
+    size_t               pool_bytes;
+    off_t                out;
+} micro_stat_t;
+
+
+ngx_int_t __wrap_ngx_http_discard_request_body(ngx_http_request_t *r);
+void __wrap_ngx_http_finalize_request(ngx_http_request_t *r, ngx_int_t rc);
+
+
+static ngx_open_file_t  micro_log_file;
+static ngx_log_t        micro_log;
+
+static void            *micro_main_conf[2];
+static void            *micro_loc_conf[2];
+
+/* set by the next body filter and ngx_http_finalize_request() */
+static ngx_uint_t       micro_links;
+static off_t            micro_out;
+static ngx_uint_t       micro_last;
+static ngx_int_t        micro_status;
+
+/* with -x, buffers taken by "upstream" are free on the next call only */
+static ngx_uint_t       micro_slow;
+static ngx_chain_t     *micro_held;
+
+
+ngx_int_t
+__wrap_ngx_http_discard_request_body(ngx_http_request_t *r)
+{
+    return NGX_OK;
+}
+
+
+void
+__wrap_ngx_http_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
+{
+    micro_status = rc;
+}
+
+
+static ngx_int_t
+micro_body_sink(ngx_http_request_t *r, ngx_chain_t *in)
+{
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl, *ln;
+
+    /* as if buffers were written to a file, they are free at once */
+
+    for (cl = micro_held; cl; cl = cl->next) {
+        cl->buf->pos = cl->buf->last;
+    }
+
+    micro_held = NULL;
+
+    for (cl = in; cl; cl = cl->next) {
+        b = cl->buf;
+
+        micro_links++;
+        micro_out += ngx_buf_size(b);
+
+        if (micro_slow && ngx_buf_in_memory(b) && ngx_buf_size(b)) {
+            ln = ngx_alloc_chain_link(r->pool);
+            if (ln == NULL) {
+                return NGX_ERROR;
+            }
+
+            ln->buf = b;
+            ln->next = micro_held;
+            micro_held = ln;
+
+        } else if (ngx_buf_in_memory(b)) {
+            b->pos = b->last;
+        }
+
+        if (b->in_file) {
+            b->file_pos = b->file_last;
+        }
+
+        if (b->last_buf) {
+            micro_last = 1;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+micro_read(char *name, micro_conf_t *mc)
+{
+    ssize_t          n;
+    ngx_fd_t         fd;
+    ngx_file_info_t  fi;
+
+    fd = ngx_open_file((u_char *) name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_EMERG, &micro_log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name);
+        return NGX_ERROR;
+    }
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_EMERG, &micro_log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name);
+        goto failed;
+    }
+
+    mc->len = (size_t) ngx_file_size(&fi);
+
+    mc->data = ngx_alloc(mc->len, &micro_log);
+    if (mc->data == NULL) {
+        goto failed;
+    }
+
+    n = ngx_read_fd(fd, mc->data, mc->len);
+
+    if (n != (ssize_t) mc->len) {
+        ngx_log_error(NGX_LOG_EMERG, &micro_log, ngx_errno,
+                      ngx_read_fd_n " \"%s\" read only %z of %uz",
+                      name, n, mc->len);
+        goto failed;
+    }
+
+    (void) ngx_close_file(fd);
+
+    return NGX_OK;
+
+failed:
+
+    (void) ngx_close_file(fd);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+micro_request(micro_conf_t *mc, size_t split, micro_stat_t *st)
+{
+    u_char                         *p, *end;
+    size_t                          size;
+    ngx_int_t                       rc;
+    ngx_buf_t                      *b;
+    ngx_uint_t                      n;
+    ngx_pool_t                     *pool, *pl;
+    ngx_chain_t                     in;
+    ngx_table_elt_t                *h;
+    ngx_pool_large_t               *large;
+    ngx_connection_t               *c;
+    ngx_http_request_t             *r;
+    ngx_http_gunzip_request_ctx_t  *ctx;
+
+    pool = ngx_create_pool(MICRO_POOL_SIZE, &micro_log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    c = ngx_pcalloc(pool, sizeof(ngx_connection_t));
+    r = ngx_pcalloc(pool, sizeof(ngx_http_request_t));
+    if (c == NULL || r == NULL) {
+        goto failed;
+    }
+
+    c->log = &micro_log;
+    c->pool = pool;
+
+    r->ctx = ngx_pcalloc(pool, sizeof(void *) * 2);
+    if (r->ctx == NULL) {
+        goto failed;
+    }
+
+    r->main_conf = micro_main_conf;
+    r->loc_conf = micro_loc_conf;
+    r->connection = c;
+    r->pool = pool;
+    r->main = r;
+    r->count = 1;
+    r->http_version = NGX_HTTP_VERSION_11;
+
+    if (ngx_list_init(&r->headers_in.headers, pool, 2, sizeof(ngx_table_elt_t))
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    h = ngx_list_push(&r->headers_in.headers);
+    if (h == NULL) {
+        goto failed;
+    }
+
+    ngx_str_set(&h->key, "Content-Encoding");
+    h->hash = ngx_http_gunzip_request_header_hash;
+    h->lowcase_key = (u_char *) "content-encoding";
+    h->value = mc->coding;
+
+    r->headers_in.content_length_n = mc->unknown_length ? -1 : (off_t) mc->len;
+
+    if (mc->no_buffering) {
+        r->request_body = ngx_pcalloc(pool, sizeof(ngx_http_request_body_t));
+        if (r->request_body == NULL) {
+            goto failed;
+        }
+
+        r->request_body_no_buffering = 1;
+    }
+
+    micro_links = 0;
+    micro_out = 0;
+    micro_last = 0;
+    micro_status = 0;
+    micro_slow = mc->no_buffering;
+    micro_held = NULL;
+
+    /* the precontent phase */
+
+    if (ngx_http_gunzip_request_handler(r) != NGX_DECLINED) {
+        goto failed;
+    }
+
+    p = mc->data;
+    end = mc->data + mc->len;
+
+    for (n = 1; /* void */; n++) {
+        size = split ? ngx_min(split, (size_t) (end - p)) : (size_t) (end - p);
+
+        b = ngx_calloc_buf(pool);
+        if (b == NULL) {
+            goto failed;
+        }
+
+        b->temporary = 1;
+        b->start = p;
+        b->pos = p;
+        b->last = p + size;
+        b->end = p + size;
+
+        p += size;
+
+        if (p == end && !mc->last_apart) {
+            b->last_buf = 1;
+        }
+
+        if (mc->flush_every && n % mc->flush_every == 0) {
+            b->flush = 1;
+        }
+
+        in.buf = b;
+        in.next = NULL;
+
+        rc = ngx_http_gunzip_request_body_filter(r, &in);
+
+        st->calls++;
+
+        if (rc == NGX_ERROR || micro_status) {
+            goto failed;
+        }
+
+        if (p == end) {
+            break;
+        }
+    }
+
+    if (mc->last_apart) {
+        b = ngx_calloc_buf(pool);
+        if (b == NULL) {
+            goto failed;
+        }
+
+        b->last_buf = 1;
+
+        in.buf = b;
+        in.next = NULL;
+
+        rc = ngx_http_gunzip_request_body_filter(r, &in);
+
+        st->calls++;
+
+        if (rc == NGX_ERROR || micro_status) {
+            goto failed;
+        }
+    }
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_gunzip_request_module);
+
+    /* upstream takes the rest, the filter is called as it reads on */
+
+    for (n = 0; micro_slow && ctx && !ctx->done && n < 1000000; n++) {
+        rc = ngx_http_gunzip_request_body_filter(r, NULL);
+
+        st->calls++;
+
+        if (rc == NGX_ERROR || micro_status) {
+            goto failed;
+        }
+    }
+
+    if (ctx == NULL || !ctx->done || !micro_last) {
+        ngx_log_error(NGX_LOG_EMERG, &micro_log, 0,
+                      "body is not finished, split:%uz", split);
+        goto failed;
+    }
+
+    st->links += micro_links;
+    st->bufs += ctx->bufs;
+    st->out += micro_out;
+
+    for (pl = pool; pl; pl = pl->d.next) {
+        st->pool_blocks++;
+        st->pool_bytes += pl->d.last - (u_char *) pl;
+    }
+
+    for (large = pool->large; large; large = large->next) {
+        if (large->alloc) {
+            st->pool_large++;
+        }
+    }
+
+    ngx_destroy_pool(pool);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_log_error(NGX_LOG_EMERG, &micro_log, 0,
+                  "request failed, split:%uz status:%i", split, micro_status);
+
+    ngx_destroy_pool(pool);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+micro_run(micro_conf_t *mc, size_t split)
+{
+    double           ns;
+    off_t            out, first;
+    ngx_uint_t       i, nreq;
+    micro_stat_t     st;
+    struct timespec  start, stop;
+
+    ngx_memzero(&st, sizeof(micro_stat_t));
+
+    nreq = mc->requests;
+
+    /* a byte per buffer takes long, keep a run in the same order */
+
+    if (split && split < 64) {
+        nreq = ngx_max(nreq / (64 / split), 1);
+    }
+
+    first = -1;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < nreq; i++) {
+        out = st.out;
+
+        if (micro_request(mc, split, &st) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (first == -1) {
+            first = st.out - out;
+
+        } else if (st.out - out != first) {
+            ngx_log_error(NGX_LOG_EMERG, &micro_log, 0,
+                          "inflated size differs: %O, %O",
+                          st.out - out, first);
+            return NGX_ERROR;
+        }
+    }
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    ns = (double) (stop.tv_sec - start.tv_sec) * 1e9
+         + (double) (stop.tv_nsec - start.tv_nsec);
+
+    printf("{\"split\": %lu, \"requests\": %lu, \"in_bytes\": %lu, "
+           "\"out_bytes\": %lu, \"us_per_request\": %.1f, "
+           "\"ns_per_in_byte\": %.3f, \"ns_per_out_byte\": %.3f, "
+           "\"filter_calls\": %.1f, \"out_links\": %.1f, "
+           "\"out_pages\": %.1f, \"pool_blocks\": %.1f, "
+           "\"pool_large\": %.1f, \"pool_bytes\": %.0f}\n",
+           (unsigned long) split, (unsigned long) nreq,
+           (unsigned long) mc->len, (unsigned long) (st.out / nreq),
+           ns / nreq / 1000,
+           ns / nreq / mc->len,
+           st.out ? ns / st.out : 0.0,
+           (double) st.calls / nreq, (double) st.links / nreq,
+           (double) st.bufs / nreq, (double) st.pool_blocks / nreq,
+           (double) st.pool_large / nreq, (double) st.pool_bytes / nreq);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+micro_list(char *s, size_t *list, ngx_uint_t *n, ngx_uint_t max)
+{
+    char  *p;
+
+    for (*n = 0; *s && *n < max; (*n)++) {
+        list[*n] = strtoul(s, &p, 10);
+
+        if (p == s || (*p != ',' && *p != '\0')) {
+            return NGX_ERROR;
+        }
+
+        s = (*p == ',') ? p + 1 : p;
+    }
+
+    return *s ? NGX_ERROR : NGX_OK;
+}
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    int                                   ch;
+    char                                 *file, *engine;
+    size_t                                splits[16], bufs[2];
+    ngx_uint_t                            i, n, nsplits, adaptive, one_shot,
+                                          single, verify_crc, max_ratio,
+                                          pool_size;
+    ngx_conf_t                            cf;
+    micro_conf_t                          mc;
+    ngx_http_core_loc_conf_t             *clcf;
+    ngx_http_gunzip_request_conf_t       *prev, *conf;
+    ngx_http_gunzip_request_coding_t     *coding;
+    ngx_http_gunzip_request_main_conf_t  *gmcf;
+
+    ngx_memzero(&mc, sizeof(micro_conf_t));
+
+    ngx_str_set(&mc.coding, "gzip");
+    mc.requests = 1000;
+
+    file = NULL;
+    engine = NULL;
+    adaptive = 0;
+    one_shot = 1;
+    single = 0;
+    verify_crc = 1;
+    max_ratio = 0;
+    pool_size = 32;
+    bufs[0] = 0;
+
+    splits[0] = 0;
+    splits[1] = 1;
+    splits[2] = 512;
+    splits[3] = 4096;
+    splits[4] = 16384;
+    splits[5] = 65536;
+    nsplits = 6;
+
+    while ((ch = getopt(argc, argv, "i:n:s:c:e:b:f:luxaowkr:p:")) != -1) {
+        switch (ch) {
+
+        case 'i':
+            file = optarg;
+            break;
+
+        case 'n':
+            mc.requests = strtoul(optarg, NULL, 10);
+            break;
+
+        case 's':
+            if (micro_list(optarg, splits, &nsplits, 16) != NGX_OK) {
+                goto usage;
+            }
+            break;
+
+        case 'c':
+            mc.coding.data = (u_char *) optarg;
+            mc.coding.len = ngx_strlen(optarg);
+            break;
+
+        case 'e':
+            engine = optarg;
+            break;
+
+        case 'b':
+            if (micro_list(optarg, bufs, &n, 2) != NGX_OK || n != 2
+                || bufs[0] == 0 || bufs[1] == 0)
+            {
+                goto usage;
+            }
+            break;
+
+        case 'f':
+            mc.flush_every = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'l':
+            mc.last_apart = 1;
+            break;
+
+        case 'u':
+            mc.unknown_length = 1;
+            break;
+
+        case 'x':
+            mc.no_buffering = 1;
+            break;
+
+        case 'a':
+            adaptive = 1;
+            break;
+
+        case 'o':
+            one_shot = 0;
+            break;
+
+        case 'w':
+            single = 1;
+            break;
+
+        case 'k':
+            verify_crc = 0;
+            break;
+
+        case 'r':
+            max_ratio = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'p':
+            pool_size = strtoul(optarg, NULL, 10);
+            break;
+
+        default:
+            goto usage;
+        }
+    }
+
+    if (file == NULL || mc.requests == 0) {
+        goto usage;
+    }
+
+    ngx_pagesize = getpagesize();
+    for (n = ngx_pagesize; n >>= 1; ngx_pagesize_shift++) { /* void */ }
+    ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+
+    if (ngx_strerror_init() != NGX_OK) {
+        return 1;
+    }
+
+    ngx_time_init();
+
+    micro_log_file.fd = ngx_stderr;
+    micro_log.file = &micro_log_file;
+    micro_log.log_level = NGX_LOG_WARN;
+
+    if (micro_read(file, &mc) != NGX_OK) {
+        return 1;
+    }
+
+    /* configuration as nginx would have merged it for a location */
+
+    ngx_memzero(&cf, sizeof(ngx_conf_t));
+
+    cf.pool = ngx_create_pool(NGX_CYCLE_POOL_SIZE, &micro_log);
+    if (cf.pool == NULL) {
+        return 1;
+    }
+
+    cf.log = &micro_log;
+
+    ngx_http_gunzip_request_module.ctx_index = 0;
+    ngx_http_core_module.ctx_index = 1;
+
+    gmcf = ngx_http_gunzip_request_create_main_conf(&cf);
+    prev = ngx_http_gunzip_request_create_conf(&cf);
+    conf = ngx_http_gunzip_request_create_conf(&cf);
+    clcf = ngx_pcalloc(cf.pool, sizeof(ngx_http_core_loc_conf_t));
+
+    if (gmcf == NULL || prev == NULL || conf == NULL || clcf == NULL) {
+        return 1;
+    }
+
+    if (engine) {
+        for (i = 0; ngx_http_gunzip_request_engines[i]; i++) {
+            if (ngx_strcmp(ngx_http_gunzip_request_engines[i]->name.data,
+                           engine) == 0)
+            {
+                gmcf->engine = ngx_http_gunzip_request_engines[i];
+                break;
+            }
+        }
+
+        if (gmcf->engine == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, &micro_log, 0,
+                          "inflate engine \"%s\" is not available", engine);
+            return 1;
+        }
+    }
+
+    gmcf->pool_size = pool_size;
+
+    (void) ngx_http_gunzip_request_init_main_conf(&cf, gmcf);
+
+    ngx_http_gunzip_request_pool_size = gmcf->pool_size;
+
+    (void) ngx_http_gunzip_request_crc32_init();
+
+    coding = ngx_http_gunzip_request_find_coding(&mc.coding,
+                                                 (ngx_uint_t) -1);
+    if (coding == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, &micro_log, 0,
+                      "content coding \"%V\" is not available", &mc.coding);
+        return 1;
+    }
+
+    conf->enable = 1;
+    conf->adaptive = adaptive;
+    conf->one_shot = one_shot;
+    conf->single_buffer = single;
+    conf->verify_crc = verify_crc;
+    conf->max_ratio = max_ratio;
+    conf->codings = NGX_CONF_BITMASK_SET|coding->mask;
+
+    if (bufs[0]) {
+        conf->bufs.num = bufs[0];
+        conf->bufs.size = bufs[1];
+    }
+
+    (void) ngx_http_gunzip_request_merge_conf(&cf, prev, conf);
+
+    clcf->client_body_buffer_size = 2 * ngx_pagesize;
+
+    micro_main_conf[0] = gmcf;
+    micro_loc_conf[0] = conf;
+    micro_loc_conf[1] = clcf;
+
+    /* as ngx_http_gunzip_request_init() does */
+
+    ngx_http_next_request_body_filter = micro_body_sink;
+
+    ngx_http_gunzip_request_identity.checked = 1;
+    ngx_http_gunzip_request_identity.skip = 1;
+
+    ngx_http_gunzip_request_header_hash =
+                      ngx_hash_key((u_char *) "content-encoding",
+                                   sizeof("content-encoding") - 1);
+
+    for (i = 0; i < nsplits; i++) {
+        if (micro_run(&mc, splits[i]) != NGX_OK) {
+            return 1;
+        }
+    }
+
+    return 0;
+
+usage:
+
+    (void) ngx_write_stderr(MICRO_USAGE);
+
+    return 1;
+}
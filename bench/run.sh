@@ -0,0 +1,130 @@
+#!/bin/sh
+#
+# Build nginx with this module, start a local sink upstream, and run wrk
+# against every case at several concurrencies.  One JSON object is printed
+# per case and concurrency, see doc/benchmark.md.
+#
+# usage: bench/run.sh /path/to/nginx-source [cases...]
+#
+# environment:
+#   WORK          work directory (bench/work)
+#   DURATION      wrk duration per run (10s)
+#   CONCURRENCY   connections to test ("1 8 64")
+#   THREADS       wrk threads (2)
+#   WORKERS       nginx worker processes under test (1)
+#   CONFIGURE     extra options for auto/configure
+#   NO_BUILD      set to skip building, reuse WORK/nginx
+
+set -e
+
+NGINX_SRC=${1:?usage: $0 /path/to/nginx-source [cases...]}
+shift
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(dirname "$BENCH")
+WORK=${WORK:-$BENCH/work}
+DATA=$WORK/data
+DURATION=${DURATION:-10s}
+CONCURRENCY=${CONCURRENCY:-"1 8 64"}
+THREADS=${THREADS:-2}
+WORKERS=${WORKERS:-1}
+NGINX=$WORK/nginx/sbin/nginx
+
+# name location method body content-encoding framing
+CASES="
+GET         test1 GET  -                   -    length
+GZ0         test1 POST 40K.json.gz         -    length
+GZ1         test1 POST 40K.json.gz         gzip length
+RAW0        test0 POST 40K.json            -    length
+RAW1        test1 POST 40K.json            -    length
+GZ1-1K      test1 POST 1K.json.gz          gzip length
+GZ1-1M      test1 POST 1M.json.gz          gzip length
+GZ1-50M     test1 POST 50M.json.gz         gzip length
+GZ1-1M-L1   test1 POST 1M-l1.json.gz       gzip length
+GZ1-1M-L9   test1 POST 1M-l9.json.gz       gzip length
+GZ1-1M-MULTI test1 POST 1M-multi.json.gz   gzip length
+GZ1-1M-CHUNKED test1 POST 1M.json.gz       gzip chunked
+GZ1-1M-THREAD test2 POST 1M.json.gz        gzip length
+"
+
+mkdir -p "$WORK" "$WORK/client_body" "$WORK/sink_body" \
+         "$WORK/gunzip_request"
+
+if [ -z "$NO_BUILD" ]; then
+    echo "building nginx in $NGINX_SRC, see $WORK/build.log" >&2
+    (
+        cd "$NGINX_SRC"
+        ./auto/configure --prefix="$WORK/nginx" --with-threads \
+            --add-module="$ROOT" $CONFIGURE
+        make -j"$(nproc 2>/dev/null || echo 2)"
+        make install
+    ) > "$WORK/build.log" 2>&1
+fi
+
+python3 "$BENCH/gen.py" "$DATA"
+
+for conf in front sink; do
+    sed -e "s|@WORK@|$WORK|g" -e "s|@DATA@|$DATA|g" \
+        -e "s|@WORKERS@|$WORKERS|g" \
+        "$BENCH/$conf.conf" > "$WORK/$conf.conf"
+done
+
+stop() {
+    for conf in front sink; do
+        [ -f "$WORK/$conf.pid" ] && "$NGINX" -p "$WORK" -c "$WORK/$conf.conf" \
+            -s quit 2>/dev/null || true
+    done
+}
+
+trap stop EXIT INT TERM
+
+"$NGINX" -p "$WORK" -c "$WORK/sink.conf"
+"$NGINX" -p "$WORK" -c "$WORK/front.conf"
+sleep 1
+
+# user + system CPU ticks of front workers
+cpu_ticks() {
+    master=$(cat "$WORK/front.pid")
+    for pid in $(pgrep -P "$master"); do
+        cat "/proc/$pid/stat"
+    done | awk '{ t += $14 + $15 } END { print t + 0 }'
+}
+
+HZ=$(getconf CLK_TCK)
+REV=$(git -C "$ROOT" rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+echo "$CASES" | while read -r name location method body coding framing; do
+    [ -z "$name" ] && continue
+
+    if [ $# -gt 0 ]; then
+        case " $* " in *" $name "*) ;; *) continue ;; esac
+    fi
+
+    file=-
+    [ "$body" != "-" ] && file=$DATA/$body
+
+    for c in $CONCURRENCY; do
+        t=$THREADS
+        [ "$c" -lt "$t" ] && t=$c
+
+        before=$(cpu_ticks)
+
+        result=$(wrk -t"$t" -c"$c" -d"$DURATION" -s "$BENCH/wrk.lua" \
+                     "http://127.0.0.1:18080/$location/" \
+                     -- "$method" "$file" "$coding" "$framing" | tail -n 1)
+
+        after=$(cpu_ticks)
+
+        echo "$result" | python3 -c '
+import json, sys
+r = json.loads(sys.stdin.read())
+name, c, rev, hz, ticks = sys.argv[1:6]
+r["case"] = name
+r["concurrency"] = int(c)
+r["rev"] = rev
+r["cpu_us_per_request"] = round(int(ticks) * 1e6 / int(hz)
+                                / max(r["requests"], 1), 1)
+print(json.dumps(r, sort_keys=True))
+' "$name" "$c" "$REV" "$HZ" "$((after - before))"
+    done
+done
@@ -0,0 +1,66 @@
+-- wrk script for bench/run.sh
+--
+-- wrk ... -s wrk.lua URL -- METHOD BODY_FILE CONTENT_ENCODING FRAMING
+--
+-- BODY_FILE and CONTENT_ENCODING are "-" for none, FRAMING is "length"
+-- or "chunked".  done() prints one JSON object.
+
+local req
+
+local function chunked(body)
+   local parts = {}
+   local size = 16 * 1024
+
+   for i = 1, #body, size do
+      local chunk = body:sub(i, i + size - 1)
+      parts[#parts + 1] = string.format("%x\r\n%s\r\n", #chunk, chunk)
+   end
+
+   parts[#parts + 1] = "0\r\n\r\n"
+
+   return table.concat(parts)
+end
+
+function init(args)
+   local method, file, coding, framing = args[1], args[2], args[3], args[4]
+   local headers = {}
+   local body = nil
+
+   if file ~= "-" then
+      local f = assert(io.open(file, "rb"))
+      body = f:read("*a")
+      f:close()
+      headers["Content-Type"] = "application/json"
+   end
+
+   if coding ~= "-" then
+      headers["Content-Encoding"] = coding
+   end
+
+   if body and framing == "chunked" then
+      headers["Transfer-Encoding"] = "chunked"
+      local r = wrk.format(method, nil, headers, nil)
+      req = r .. chunked(body)
+   else
+      req = wrk.format(method, nil, headers, body)
+   end
+end
+
+function request()
+   return req
+end
+
+function done(summary, latency, requests)
+   local errors = summary.errors
+   local seconds = summary.duration / 1000000
+
+   io.write(string.format(
+      '{"requests":%d,"duration_s":%.3f,"rps":%.1f,' ..
+      '"p50_ms":%.3f,"p99_ms":%.3f,"max_ms":%.3f,' ..
+      '"errors":%d,"non2xx":%d}\n',
+      summary.requests, seconds, summary.requests / seconds,
+      latency:percentile(50) / 1000, latency:percentile(99) / 1000,
+      latency.max / 1000,
+      errors.connect + errors.read + errors.write + errors.timeout,
+      errors.status))
+end
@@ -0,0 +1,275 @@
+
+/*
+ * CRC-32 of gzip trailers, see gunzip_request_verify_crc.
+ *
+ * Carry-less multiplication folding (PCLMULQDQ) on x86, the CRC32
+ * instructions of ARMv8, chosen by what the CPU has at startup, and zlib's
+ * crc32() otherwise.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include <zlib.h>
+
+#include "ngx_http_gunzip_request_engine.h"
+
+
+#if ((defined __x86_64__ || defined __i386__)                                 \
+     && (__GNUC__ >= 5 || defined __clang__))
+
+#define NGX_HTTP_GUNZIP_REQUEST_CRC32_PCLMUL  1
+#include <cpuid.h>
+#include <immintrin.h>
+
+#elif (defined __aarch64__ && NGX_LINUX                                       \
+       && (__GNUC__ >= 10 || defined __clang__))
+
+#define NGX_HTTP_GUNZIP_REQUEST_CRC32_ARMV8  1
+#include <arm_acle.h>
+#include <sys/auxv.h>
+
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32  (1 << 7)
+#endif
+
+#endif
+
+
+static uint32_t ngx_http_gunzip_request_crc32_zlib(uint32_t crc, u_char *p,
+    size_t len);
+
+static uint32_t (*ngx_http_gunzip_request_crc32_kernel)(uint32_t crc,
+    u_char *p, size_t len) = ngx_http_gunzip_request_crc32_zlib;
+
+
+static uint32_t
+ngx_http_gunzip_request_crc32_zlib(uint32_t crc, u_char *p, size_t len)
+{
+    size_t  n;
+
+    /* crc32() takes uInt */
+
+    while (len) {
+        n = ngx_min(len, 0x40000000);
+
+        crc = (uint32_t) crc32(crc, p, (uInt) n);
+
+        p += n;
+        len -= n;
+    }
+
+    return crc;
+}
+
+
+#if (NGX_HTTP_GUNZIP_REQUEST_CRC32_PCLMUL)
+
+/*
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction", Intel, 2009: four 128-bit lanes are folded by 512 bits,
+ * then into one lane, and Barrett reduced to 32 bits.  The constants are
+ * x^n mod P(x), bit reflected, for the gzip polynomial.
+ */
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t
+ngx_http_gunzip_request_crc32_fold(uint32_t crc, u_char *p, size_t len)
+{
+    __m128i  x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    static const uint64_t  k1k2[2] __attribute__((aligned(16))) =
+        { 0x0154442bd4, 0x01c6e41596 };
+    static const uint64_t  k3k4[2] __attribute__((aligned(16))) =
+        { 0x01751997d0, 0x00ccaa009e };
+    static const uint64_t  k5k0[2] __attribute__((aligned(16))) =
+        { 0x0163cd6124, 0x0000000000 };
+    static const uint64_t  poly[2] __attribute__((aligned(16))) =
+        { 0x01db710641, 0x01f7011641 };
+
+    /* len is 64 or more, and a multiple of 16 */
+
+    x1 = _mm_loadu_si128((__m128i *) (p + 0x00));
+    x2 = _mm_loadu_si128((__m128i *) (p + 0x10));
+    x3 = _mm_loadu_si128((__m128i *) (p + 0x20));
+    x4 = _mm_loadu_si128((__m128i *) (p + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+
+    x0 = _mm_load_si128((__m128i *) k1k2);
+
+    p += 64;
+    len -= 64;
+
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((__m128i *) (p + 0x00));
+        y6 = _mm_loadu_si128((__m128i *) (p + 0x10));
+        y7 = _mm_loadu_si128((__m128i *) (p + 0x20));
+        y8 = _mm_loadu_si128((__m128i *) (p + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        p += 64;
+        len -= 64;
+    }
+
+    /* four lanes into one */
+
+    x0 = _mm_load_si128((__m128i *) k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while (len >= 16) {
+        x2 = _mm_loadu_si128((__m128i *) p);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        p += 16;
+        len -= 16;
+    }
+
+    /* 128 bits to 64 */
+
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((__m128i *) k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+
+    x0 = _mm_load_si128((__m128i *) poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t) _mm_extract_epi32(x1, 1);
+}
+
+
+static uint32_t
+ngx_http_gunzip_request_crc32_pclmul(uint32_t crc, u_char *p, size_t len)
+{
+    size_t  n;
+
+    if (len >= 64) {
+        n = len & ~(size_t) 15;
+
+        crc = ~ngx_http_gunzip_request_crc32_fold(~crc, p, n);
+
+        p += n;
+        len -= n;
+    }
+
+    return ngx_http_gunzip_request_crc32_zlib(crc, p, len);
+}
+
+#endif
+
+
+#if (NGX_HTTP_GUNZIP_REQUEST_CRC32_ARMV8)
+
+#if (defined __clang__)
+__attribute__((target("crc")))
+#else
+__attribute__((target("+crc")))
+#endif
+static uint32_t
+ngx_http_gunzip_request_crc32_armv8(uint32_t crc, u_char *p, size_t len)
+{
+    uint64_t  v;
+
+    crc = ~crc;
+
+    while (len && ((uintptr_t) p & 7)) {
+        crc = __crc32b(crc, *p++);
+        len--;
+    }
+
+    while (len >= 8) {
+        ngx_memcpy(&v, p, 8);
+        crc = __crc32d(crc, v);
+
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = __crc32b(crc, *p++);
+    }
+
+    return ~crc;
+}
+
+#endif
+
+
+uint32_t
+ngx_http_gunzip_request_crc32(uint32_t crc, u_char *p, size_t len)
+{
+    return ngx_http_gunzip_request_crc32_kernel(crc, p, len);
+}
+
+
+char *
+ngx_http_gunzip_request_crc32_init(void)
+{
+#if (NGX_HTTP_GUNZIP_REQUEST_CRC32_PCLMUL)
+
+    unsigned int  eax, ebx, ecx, edx;
+
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)
+        && (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1))
+    {
+        ngx_http_gunzip_request_crc32_kernel =
+                                          ngx_http_gunzip_request_crc32_pclmul;
+        return "pclmul";
+    }
+
+#elif (NGX_HTTP_GUNZIP_REQUEST_CRC32_ARMV8)
+
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        ngx_http_gunzip_request_crc32_kernel =
+                                           ngx_http_gunzip_request_crc32_armv8;
+        return "armv8";
+    }
+
+#endif
+
+    return "zlib";
+}
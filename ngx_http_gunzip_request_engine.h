@@ -0,0 +1,82 @@
+#ifndef _NGX_HTTP_GUNZIP_REQUEST_ENGINE_H_INCLUDED_
+#define _NGX_HTTP_GUNZIP_REQUEST_ENGINE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_HTTP_GUNZIP_REQUEST_NO_FLUSH    0
+#define NGX_HTTP_GUNZIP_REQUEST_SYNC_FLUSH  1
+#define NGX_HTTP_GUNZIP_REQUEST_FINISH      2
+
+
+typedef struct {
+    u_char              *next_in;
+    size_t               avail_in;
+    u_char              *next_out;
+    size_t               avail_out;
+    /* gunzip_request_verify_crc off, for engines which check it */
+    unsigned             skip_crc:1;
+} ngx_http_gunzip_request_io_t;
+
+
+/* gunzip_request_dictionary, loaded at configuration time */
+
+typedef struct {
+    ngx_str_t            id;
+    u_char              *data;
+    size_t               len;
+    /* DICTID of zlib format */
+    uint32_t             adler;
+    /* ZSTD_DDict, when zstd is available */
+    void                *ddict;
+} ngx_http_gunzip_request_dict_t;
+
+
+/*
+ * An inflate engine decodes one gzip member at a time.
+ *
+ * create()  allocates and initializes a decoder, it is kept in the per
+ *           worker pool and must not use request memory;
+ * reset()   prepares a decoder for the next member or request, it is NULL
+ *           for decoders which can't be reset, they are created for each
+ *           request and not pooled;
+ * feed()    consumes io->next_in and fills io->next_out, it returns NGX_OK
+ *           while the member is not finished, NGX_DONE at the end of the
+ *           member, and NGX_ERROR on broken input;
+ * destroy() releases a decoder;
+ * dictionary() sets a preset dictionary for the request, or clears it
+ *           with NULL, it is NULL for engines without dictionaries.
+ *
+ * free and nfree are the per worker pool of decoders ready for reuse.
+ */
+
+typedef struct {
+    ngx_str_t            name;
+    void              *(*create)(ngx_log_t *log);
+    ngx_int_t          (*reset)(void *data, ngx_log_t *log);
+    ngx_int_t          (*feed)(void *data, ngx_http_gunzip_request_io_t *io,
+                               ngx_uint_t flush, ngx_log_t *log);
+    void               (*destroy)(void *data);
+
+    ngx_queue_t          free;
+    ngx_uint_t           nfree;
+
+    ngx_int_t          (*dictionary)(void *data,
+                                     ngx_http_gunzip_request_dict_t *dict,
+                                     ngx_log_t *log);
+} ngx_http_gunzip_request_engine_t;
+
+
+#if (NGX_HTTP_GUNZIP_REQUEST_ZLIB_NG)
+extern ngx_http_gunzip_request_engine_t  ngx_http_gunzip_request_zlib_ng_engine;
+#endif
+
+
+/* CRC-32 as zlib's crc32(), by the fastest kernel the CPU has */
+uint32_t ngx_http_gunzip_request_crc32(uint32_t crc, u_char *p, size_t len);
+char *ngx_http_gunzip_request_crc32_init(void);
+
+
+#endif /* _NGX_HTTP_GUNZIP_REQUEST_ENGINE_H_INCLUDED_ */
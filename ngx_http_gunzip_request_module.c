@@ -1,16 +1,206 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <nginx.h>
 
 #include <zlib.h>
 
+#if (NGX_HTTP_GUNZIP_REQUEST_ISAL)
+#include <isa-l/igzip_lib.h>
+#endif
+
+#if (NGX_HTTP_GUNZIP_REQUEST_LIBDEFLATE)
+#include <libdeflate.h>
+#endif
+
+#if (NGX_HTTP_GUNZIP_REQUEST_BROTLI)
+#include <brotli/decode.h>
+#endif
+
+#if (NGX_HTTP_GUNZIP_REQUEST_ZSTD || NGX_HTTP_GUNZIP_REQUEST_ZSTD_ENCODER)
+#include <zstd.h>
+#endif
+
+#if (NGX_HTTP_GUNZIP_REQUEST_LZ4)
+#include <lz4frame.h>
+#endif
+
+#include "ngx_http_gunzip_request_engine.h"
+
+
+/* rb->filter_need_buffering lets a body filter hold the body, 1.21.2+ */
+#if (nginx_version >= 1021002)
+#define NGX_HTTP_GUNZIP_REQUEST_NEED_BUFFERING  1
+#endif
+
+#if (NGX_THREADS && NGX_HTTP_GUNZIP_REQUEST_NEED_BUFFERING)
+#define NGX_HTTP_GUNZIP_REQUEST_THREADS  1
+#endif
+
+
+#define NGX_HTTP_GUNZIP_REQUEST_CODING_GZIP     0x0002
+#define NGX_HTTP_GUNZIP_REQUEST_CODING_DEFLATE  0x0004
+#define NGX_HTTP_GUNZIP_REQUEST_CODING_BR       0x0008
+#define NGX_HTTP_GUNZIP_REQUEST_CODING_ZSTD     0x0010
+
+
+/* compression ratios are kept in 1/16 units */
+#define NGX_HTTP_GUNZIP_REQUEST_RATIO_INIT      (4 * 16)
+#define NGX_HTTP_GUNZIP_REQUEST_RATIO_MAX       (1024 * 16)
+
+/* deflate never inflates more than this many bytes from one byte */
+#define NGX_HTTP_GUNZIP_REQUEST_DEFLATE_MAX     1032
+
+/* output below this is never rejected by gunzip_request_max_ratio */
+#define NGX_HTTP_GUNZIP_REQUEST_RATIO_SLACK     (64 * 1024)
+
+/* inflate time histogram, 100us to 1s by 10 and +Inf */
+#define NGX_HTTP_GUNZIP_REQUEST_BUCKETS         6
+
+/* gunzip_request_transcode output buffers, and lz4 input per call */
+#define NGX_HTTP_GUNZIP_REQUEST_TRANSCODE_BUF   (64 * 1024)
+#define NGX_HTTP_GUNZIP_REQUEST_LZ4_BLOCK       (32 * 1024)
+
+/* gunzip_request_thread_parallel, a part is never cut smaller than this */
+#define NGX_HTTP_GUNZIP_REQUEST_PARTS_MAX       32
+#define NGX_HTTP_GUNZIP_REQUEST_PART_MIN        (64 * 1024)
+
+
+/* shared by all workers, see gunzip_request_status */
+
+typedef struct {
+    ngx_atomic_t         requests;
+    ngx_atomic_t         in_bytes;
+    ngx_atomic_t         out_bytes;
+    ngx_atomic_t         errors;
+    ngx_atomic_t         rejected;
+    ngx_atomic_t         bombs;
+    ngx_atomic_t         nomem;
+    ngx_atomic_t         waits;
+    ngx_atomic_t         memory;
+    ngx_atomic_t         pool_hits;
+    ngx_atomic_t         pool_misses;
+    ngx_atomic_t         cache_hits;
+    ngx_atomic_t         cache_misses;
+    ngx_atomic_t         usec;
+    ngx_atomic_t         latency[NGX_HTTP_GUNZIP_REQUEST_BUCKETS];
+} ngx_http_gunzip_request_stats_t;
+
+
+typedef struct {
+    ngx_str_t            name;
+    ngx_str_t            help;
+    size_t               offset;
+} ngx_http_gunzip_request_counter_t;
+
+
+/* gunzip_request_cache_zone, inflated bodies by CRC32 of gzip trailer */
+
+typedef struct {
+    ngx_rbtree_t         rbtree;
+    ngx_rbtree_node_t    sentinel;
+    /* least recently used entries at the tail */
+    ngx_queue_t          queue;
+} ngx_http_gunzip_request_cache_sh_t;
+
+
+typedef struct {
+    ngx_http_gunzip_request_cache_sh_t  *sh;
+    ngx_slab_pool_t                     *shpool;
+} ngx_http_gunzip_request_cache_t;
+
+
+typedef struct {
+    ngx_rbtree_node_t    node;
+    ngx_queue_t          queue;
+    size_t               in_len;
+    size_t               out_len;
+    /* compressed body, then inflated one */
+    u_char               data[1];
+} ngx_http_gunzip_request_cache_node_t;
+
+
+typedef struct {
+    ngx_str_t                          name;
+    ngx_uint_t                         mask;
+
+    /* NULL for gzip, the engine is set by gunzip_request_engine */
+    ngx_http_gunzip_request_engine_t  *engine;
+} ngx_http_gunzip_request_coding_t;
+
+
+typedef struct {
+    ngx_http_gunzip_request_engine_t  *engine;
+    ngx_uint_t           pool_size;
+    size_t               memory_limit;
+    ngx_shm_zone_t      *shm_zone;
+    ngx_array_t         *dictionaries;
+} ngx_http_gunzip_request_main_conf_t;
+
+
+/*
+ * An encoder of gunzip_request_transcode, kept in the per worker pool
+ * like decoders.  Its feed() returns NGX_AGAIN when it needs more output
+ * room, and NGX_OK when the input is consumed and, with SYNC_FLUSH or
+ * FINISH, everything is written out.  engine.name is the new
+ * Content-Encoding.
+ */
+
+typedef struct {
+    ngx_http_gunzip_request_engine_t   engine;
+    ngx_uint_t                         mask;
+    ngx_int_t                          default_level;
+    ngx_int_t                          max_level;
+    ngx_int_t                        (*level)(void *data, ngx_int_t level,
+                                              ngx_log_t *log);
+} ngx_http_gunzip_request_encoder_t;
+
+
 typedef struct {
     ngx_flag_t           enable;
+    /* decided per request, when it is not plain on or off */
+    ngx_http_complex_value_t  *enable_value;
     ngx_bufs_t           bufs;
     size_t               max_inflate_size;
+    ngx_uint_t           max_ratio;
+    ngx_flag_t           one_shot;
+    ngx_flag_t           single_buffer;
+    ngx_flag_t           verify_crc;
+    size_t               input_batch;
+    ngx_flag_t           stream;
+    ngx_uint_t           codings;
+    size_t               slice;
+    ngx_path_t          *temp_path;
+
+    ngx_http_gunzip_request_encoder_t  *transcode;
+    ngx_int_t            transcode_level;
+
+    ngx_shm_zone_t      *cache_zone;
+    size_t               cache_max_size;
+
+    ngx_flag_t           adaptive;
+
+#if (NGX_HTTP_GUNZIP_REQUEST_THREADS)
+    ngx_thread_pool_t   *thread_pool;
+    size_t               thread_threshold;
+    ngx_uint_t           thread_parallel;
+#endif
 } ngx_http_gunzip_request_conf_t;
 
 
+typedef struct {
+    ngx_queue_t          queue;
+    ngx_http_gunzip_request_engine_t  *engine;
+    void                *data;
+} ngx_http_gunzip_request_state_t;
+
+
+#if (NGX_HTTP_GUNZIP_REQUEST_THREADS)
+typedef struct ngx_http_gunzip_request_parallel_s
+    ngx_http_gunzip_request_parallel_t;
+#endif
+
+
 typedef struct {
     ngx_chain_t         *in;
     ngx_chain_t         *free;
@@ -20,7 +210,12 @@ typedef struct {
 
     ngx_buf_t           *in_buf;
     ngx_buf_t           *out_buf;
+    ngx_buf_t           *batch;
+    ngx_buf_t           *file_buf;
+    ngx_temp_file_t     *temp_file;
     ngx_int_t            bufs;
+    size_t               size_hint;
+    size_t               buf_size;
 
     unsigned             started:1;
     unsigned             flush:4;
@@ -30,701 +225,6391 @@ typedef struct {
 
     unsigned             skip:1;
     unsigned             checked:1;
+    unsigned             thread:1;
+    unsigned             in_file:1;
+    unsigned             spill:1;
+    unsigned             backpressure:1;
+    unsigned             overbudget:1;
+    unsigned             single:1;
+    unsigned             stream:1;
 
     size_t               sum;
+    off_t                received;
+    ngx_uint_t           usec;
 
-    z_stream             zstream;
+    /* compressed bytes still expected by the dropped Content-Length */
+    off_t                length;
+    ngx_table_elt_t     *content_length;
+
+    /* charged to gunzip_request_memory_limit */
+    size_t               mem;
+
+    ngx_http_gunzip_request_io_t        io;
+    ngx_http_gunzip_request_coding_t   *coding;
+    ngx_table_elt_t                    *header;
+    ngx_http_gunzip_request_state_t    *state;
     ngx_http_request_t  *request;
-} ngx_http_gunzip_request_ctx_t;
 
+    /* gunzip_request_transcode */
+    ngx_http_gunzip_request_state_t    *enc;
+    ngx_buf_t           *enc_buf;
+    ngx_buf_t           *enc_in;
+    ngx_chain_t         *enc_free;
+    ngx_chain_t         *enc_busy;
+    off_t                enc_sum;
+
+#if (NGX_HTTP_GUNZIP_REQUEST_NEED_BUFFERING)
+    /* gunzip_request_slice, posted to continue inflating */
+    ngx_event_t         *slice_ev;
+#endif
 
-static ngx_int_t ngx_http_gunzip_request_init(ngx_conf_t *cf);
-static void *ngx_http_gunzip_request_create_conf(ngx_conf_t *cf);
-static char *ngx_http_gunzip_request_merge_conf(ngx_conf_t *cf,
-    void *parent, void *child);
+    /* a cache miss, stored when the body is inflated */
+    u_char              *cache_in;
+    size_t               cache_len;
+    uint32_t             cache_key;
 
+#if (NGX_HTTP_GUNZIP_REQUEST_THREADS)
+    ngx_buf_t           *thread_in;
+    ngx_thread_task_t   *task;
+    ngx_http_gunzip_request_parallel_t  *parallel;
+#endif
+} ngx_http_gunzip_request_ctx_t;
 
-static ngx_command_t  ngx_http_gunzip_request_commands[] = {
 
-    { ngx_string("gunzip_request"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
-      ngx_conf_set_flag_slot,
-      NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_gunzip_request_conf_t, enable),
-      NULL },
+/* an input buffer which still has unread data in a file */
+#define ngx_http_gunzip_request_file_left(b)                                  \
+    ((b) && !ngx_buf_in_memory(b) && (b)->in_file                             \
+     && (b)->file_pos < (b)->file_last)
 
-    { ngx_string("gunzip_request_buffers"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE2,
-      ngx_conf_set_bufs_slot,
-      NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_gunzip_request_conf_t, bufs),
-      NULL },
 
-    { ngx_string("gunzip_request_max_inflate_size"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
-      ngx_conf_set_size_slot,
-      NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_gunzip_request_conf_t, max_inflate_size),
-      NULL },
+#if (NGX_HTTP_GUNZIP_REQUEST_THREADS)
 
-      ngx_null_command
-};
+/*
+ * Shared with a thread task.  The task inflates the whole body from
+ * "in" into heap chunks described by "bufs", it must not touch the
+ * request, its pool or the per worker decoder pool.
+ */
 
+typedef struct {
+    ngx_http_gunzip_request_state_t  *state;
 
-static ngx_http_module_t  ngx_http_gunzip_request_module_ctx = {
-    NULL,                                  /* preconfiguration */
-    ngx_http_gunzip_request_init,          /* postconfiguration */
+    u_char              *in;
+    size_t               in_size;
 
-    NULL,                                  /* create main configuration */
-    NULL,                                  /* init main configuration */
+    ngx_buf_t           *bufs;
+    ngx_uint_t           nbufs;
+    ngx_uint_t           nout;
+    size_t               size;
+    size_t               size_hint;
 
-    NULL,                                  /* create server configuration */
-    NULL,                                  /* merge server configuration */
+    /* inflated data which did not fit in bufs, the file is opened for us */
+    ngx_temp_file_t     *temp_file;
 
-    ngx_http_gunzip_request_create_conf,           /* create location configuration */
-    ngx_http_gunzip_request_merge_conf             /* merge location configuration */
-};
+    size_t               sum;
+    size_t               max_inflate_size;
+    ngx_uint_t           max_ratio;
+    ngx_uint_t           skip_crc;
+    ngx_uint_t           usec;
 
+    /* parts of one body draw on the same buffers and size limit */
+    ngx_atomic_t        *pages;
+    ngx_atomic_t        *total;
 
-ngx_module_t  ngx_http_gunzip_request_module = {
-    NGX_MODULE_V1,
-    &ngx_http_gunzip_request_module_ctx,   /* module context */
-    ngx_http_gunzip_request_commands,      /* module directives */
-    NGX_HTTP_MODULE,                       /* module type */
-    NULL,                                  /* init master */
-    NULL,                                  /* init module */
-    NULL,                                  /* init process */
-    NULL,                                  /* init thread */
-    NULL,                                  /* exit thread */
-    NULL,                                  /* exit process */
-    NULL,                                  /* exit master */
-    NGX_MODULE_V1_PADDING
-};
+    ngx_int_t            rc;
+} ngx_http_gunzip_request_thread_ctx_t;
 
 
-static ngx_http_request_body_filter_pt   ngx_http_next_request_body_filter;
+/* a multi member gzip body cut at member headers, a task per part */
 
+struct ngx_http_gunzip_request_parallel_s {
+    ngx_atomic_t         pages;
+    ngx_atomic_t         total;
 
-static void *
-ngx_http_gunzip_request_create_conf(ngx_conf_t *cf)
-{
-    ngx_http_gunzip_request_conf_t  *conf;
+    ngx_uint_t           nparts;
+    ngx_uint_t           pending;
+    ngx_http_gunzip_request_thread_ctx_t
+                        *parts[NGX_HTTP_GUNZIP_REQUEST_PARTS_MAX];
 
-    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_gunzip_request_conf_t));
-    if (conf == NULL) {
-        return NULL;
-    }
+    unsigned             failed:1;
+};
 
-    conf->enable = NGX_CONF_UNSET;
+#endif
 
-    conf->max_inflate_size = NGX_CONF_UNSET_SIZE;
 
-    return conf;
-}
+static ngx_int_t ngx_http_gunzip_request_add_variables(ngx_conf_t *cf);
+static ngx_int_t ngx_http_gunzip_request_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_gunzip_request_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_gunzip_request_handler(ngx_http_request_t *r);
+static ngx_table_elt_t *ngx_http_gunzip_request_find_header(
+    ngx_http_request_t *r, ngx_str_t *name, ngx_uint_t hash);
+static ngx_http_gunzip_request_ctx_t *ngx_http_gunzip_request_detect(
+    ngx_http_request_t *r, ngx_http_gunzip_request_conf_t *conf);
+static void *ngx_http_gunzip_request_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_gunzip_request_init_main_conf(ngx_conf_t *cf,
+    void *conf);
+static void *ngx_http_gunzip_request_create_conf(ngx_conf_t *cf);
+static char *ngx_http_gunzip_request_merge_conf(ngx_conf_t *cf,
+    void *parent, void *child);
+static char *ngx_http_gunzip_request_enable(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_gunzip_request_engine(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_gunzip_request_transcode(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_gunzip_request_dictionary(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static void ngx_http_gunzip_request_dictionary_cleanup(void *data);
+static ngx_http_gunzip_request_dict_t *
+    ngx_http_gunzip_request_dictionary_find(ngx_http_request_t *r);
+static char *ngx_http_gunzip_request_cache_zone(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_gunzip_request_cache(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_http_gunzip_request_cache_init_zone(
+    ngx_shm_zone_t *shm_zone, void *data);
+static char *ngx_http_gunzip_request_thread_pool(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_gunzip_request_status(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_http_gunzip_request_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_http_gunzip_request_status_handler(
+    ngx_http_request_t *r);
+static ngx_int_t ngx_http_gunzip_request_init_module(ngx_cycle_t *cycle);
+
+static ngx_int_t ngx_http_gunzip_request_read_file(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx);
+static ngx_int_t ngx_http_gunzip_request_transcode_start(
+    ngx_http_request_t *r, ngx_http_gunzip_request_ctx_t *ctx);
+static ngx_int_t ngx_http_gunzip_request_transcode_filter(
+    ngx_http_request_t *r, ngx_chain_t *in);
+static ngx_int_t ngx_http_gunzip_request_encode(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx, u_char *p, size_t size,
+    ngx_uint_t flush, ngx_chain_t ***ll);
+static void ngx_http_gunzip_request_transcode_cleanup(void *data);
+#if (NGX_HTTP_GUNZIP_REQUEST_NEED_BUFFERING)
+static ngx_int_t ngx_http_gunzip_request_hold(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx);
+static ngx_int_t ngx_http_gunzip_request_slice(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx);
+static void ngx_http_gunzip_request_slice_handler(ngx_event_t *ev);
+static void ngx_http_gunzip_request_slice_cleanup(void *data);
+#endif
+static ngx_int_t ngx_http_gunzip_request_cache_lookup(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx, ngx_chain_t *in);
+static void ngx_http_gunzip_request_cache_store(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx, ngx_buf_t *b);
+static ngx_http_gunzip_request_cache_node_t *
+    ngx_http_gunzip_request_cache_find(ngx_http_gunzip_request_cache_t *cache,
+    uint32_t key, u_char *p, size_t len);
+static void ngx_http_gunzip_request_cache_insert(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_temp_file_t *ngx_http_gunzip_request_temp_file(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx);
+
+#if (NGX_HTTP_GUNZIP_REQUEST_THREADS)
+static void ngx_http_gunzip_request_thread_handler(void *data, ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_thread_spill(
+    ngx_http_gunzip_request_thread_ctx_t *t);
+static void ngx_http_gunzip_request_thread_event_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_gunzip_request_thread_output(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx);
+static void ngx_http_gunzip_request_thread_cleanup(void *data);
+static ngx_int_t ngx_http_gunzip_request_thread_post(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx);
+static ngx_int_t ngx_http_gunzip_request_parallel(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx);
+static void ngx_http_gunzip_request_parallel_event_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_gunzip_request_parallel_output(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx);
+static void ngx_http_gunzip_request_part_cleanup(void *data);
+#endif
+static ngx_int_t ngx_http_gunzip_request_init_process(ngx_cycle_t *cycle);
+
+static void *ngx_http_gunzip_request_zlib_create(ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_zlib_reset(void *data,
+    ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_zlib_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_gzip_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log);
+static void ngx_http_gunzip_request_zlib_destroy(void *data);
+
+static void *ngx_http_gunzip_request_deflate_create(ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_deflate_reset(void *data,
+    ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_deflate_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_deflate_dictionary(void *data,
+    ngx_http_gunzip_request_dict_t *dict, ngx_log_t *log);
+
+#if (NGX_HTTP_GUNZIP_REQUEST_BROTLI)
+static void *ngx_http_gunzip_request_brotli_create(ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_brotli_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log);
+static void ngx_http_gunzip_request_brotli_destroy(void *data);
+#endif
 
+#if (NGX_HTTP_GUNZIP_REQUEST_ZSTD)
+static void *ngx_http_gunzip_request_zstd_create(ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_zstd_reset(void *data,
+    ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_zstd_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log);
+static void ngx_http_gunzip_request_zstd_destroy(void *data);
+static ngx_int_t ngx_http_gunzip_request_zstd_dictionary(void *data,
+    ngx_http_gunzip_request_dict_t *dict, ngx_log_t *log);
+#endif
 
-static char *
-ngx_http_gunzip_request_merge_conf(ngx_conf_t *cf, void *parent, void *child)
-{
-    ngx_http_gunzip_request_conf_t *prev = parent;
-    ngx_http_gunzip_request_conf_t *conf = child;
+#if (NGX_HTTP_GUNZIP_REQUEST_ZSTD_ENCODER)
+static void *ngx_http_gunzip_request_zstd_enc_create(ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_zstd_enc_reset(void *data,
+    ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_zstd_enc_level(void *data,
+    ngx_int_t level, ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_zstd_enc_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log);
+static void ngx_http_gunzip_request_zstd_enc_destroy(void *data);
+#endif
 
-    ngx_conf_merge_value(conf->enable, prev->enable, 0);
+#if (NGX_HTTP_GUNZIP_REQUEST_LZ4)
+static void *ngx_http_gunzip_request_lz4_create(ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_lz4_reset(void *data,
+    ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_lz4_level(void *data,
+    ngx_int_t level, ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_lz4_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log);
+static void ngx_http_gunzip_request_lz4_destroy(void *data);
+#endif
 
-    ngx_conf_merge_bufs_value(conf->bufs, prev->bufs,
-                              (128 * 1024) / ngx_pagesize, ngx_pagesize);
+#if (NGX_HTTP_GUNZIP_REQUEST_ISAL)
+static void *ngx_http_gunzip_request_isal_create(ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_isal_reset(void *data,
+    ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_isal_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log);
+static void ngx_http_gunzip_request_isal_destroy(void *data);
+#endif
 
-    ngx_conf_merge_size_value(conf->max_inflate_size, prev->max_inflate_size, 0);
 
-    return NGX_CONF_OK;
-}
+static ngx_http_gunzip_request_engine_t  ngx_http_gunzip_request_zlib_engine = {
+    ngx_string("zlib"),
+    ngx_http_gunzip_request_zlib_create,
+    ngx_http_gunzip_request_zlib_reset,
+    ngx_http_gunzip_request_gzip_feed,
+    ngx_http_gunzip_request_zlib_destroy,
+    { NULL, NULL },
+    0,
+    NULL
+};
 
-static void *
-ngx_http_gunzip_request_alloc(void *opaque, u_int items, u_int size)
-{
-    ngx_http_gunzip_request_ctx_t *ctx = opaque;
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ctx->request->connection->log, 0,
-                   "[gunzreq] gunzip alloc: n:%ud s:%ud",
-                   items, size);
+static ngx_http_gunzip_request_engine_t  ngx_http_gunzip_request_deflate_engine = {
+    ngx_string("deflate"),
+    ngx_http_gunzip_request_deflate_create,
+    ngx_http_gunzip_request_deflate_reset,
+    ngx_http_gunzip_request_deflate_feed,
+    ngx_http_gunzip_request_zlib_destroy,
+    { NULL, NULL },
+    0,
+    ngx_http_gunzip_request_deflate_dictionary
+};
 
-    return ngx_palloc(ctx->request->pool, items * size);
-}
 
+#if (NGX_HTTP_GUNZIP_REQUEST_BROTLI)
 
-static void
-ngx_http_gunzip_request_free(void *opaque, void *address)
-{
-#if 0
-    ngx_http_gunzip_request_ctx_t *ctx = opaque;
+static ngx_http_gunzip_request_engine_t  ngx_http_gunzip_request_brotli_engine = {
+    ngx_string("brotli"),
+    ngx_http_gunzip_request_brotli_create,
+    /* a decoder can't be reset, so it is not pooled */
+    NULL,
+    ngx_http_gunzip_request_brotli_feed,
+    ngx_http_gunzip_request_brotli_destroy,
+    { NULL, NULL },
+    0,
+    NULL
+};
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->request->connection->log, 0,
-                   "[gunzreq] gunzip free: %p", address);
 #endif
-}
-
-static ngx_int_t
-ngx_http_gunzip_request_inflate_start(ngx_http_request_t *r,
-    ngx_http_gunzip_request_ctx_t *ctx)
-{
-    int  rc;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "[gunzreq] inflate start");
 
-    ctx->request = r;
+#if (NGX_HTTP_GUNZIP_REQUEST_ZSTD)
 
-    ctx->zstream.next_in = Z_NULL;
-    ctx->zstream.avail_in = 0;
+static ngx_http_gunzip_request_engine_t  ngx_http_gunzip_request_zstd_engine = {
+    ngx_string("zstd"),
+    ngx_http_gunzip_request_zstd_create,
+    ngx_http_gunzip_request_zstd_reset,
+    ngx_http_gunzip_request_zstd_feed,
+    ngx_http_gunzip_request_zstd_destroy,
+    { NULL, NULL },
+    0,
+    ngx_http_gunzip_request_zstd_dictionary
+};
 
-    ctx->zstream.zalloc = ngx_http_gunzip_request_alloc;
-    ctx->zstream.zfree = ngx_http_gunzip_request_free;
-    ctx->zstream.opaque = ctx;
+#endif
 
-    /* windowBits +16 to decode gzip, zlib 1.2.0.4+ */
-    rc = inflateInit2(&ctx->zstream, MAX_WBITS + 16);
 
-    if (rc != Z_OK) {
-        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
-                      "[gunzreq] inflateInit2() failed: %d", rc);
-        return NGX_ERROR;
-    }
+#if (NGX_HTTP_GUNZIP_REQUEST_ISAL)
 
-    ctx->started = 1;
+static ngx_http_gunzip_request_engine_t  ngx_http_gunzip_request_isal_engine = {
+    ngx_string("isal"),
+    ngx_http_gunzip_request_isal_create,
+    ngx_http_gunzip_request_isal_reset,
+    ngx_http_gunzip_request_isal_feed,
+    ngx_http_gunzip_request_isal_destroy,
+    { NULL, NULL },
+    0,
+    NULL
+};
 
-    ctx->last_out = &ctx->out;
-    ctx->flush = Z_NO_FLUSH;
+#endif
 
-    return NGX_OK;
-}
 
-static ngx_int_t
-ngx_http_gunzip_request_inflate_end(ngx_http_request_t *r,
-    ngx_http_gunzip_request_ctx_t *ctx)
-{
-    int           rc;
-    ngx_buf_t    *b;
-    ngx_chain_t  *cl;
+#if (NGX_HTTP_GUNZIP_REQUEST_ZSTD_ENCODER)
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "[gunzreq] gunzip inflate end");
+static ngx_http_gunzip_request_encoder_t  ngx_http_gunzip_request_zstd_encoder = {
+    { ngx_string("zstd"),
+      ngx_http_gunzip_request_zstd_enc_create,
+      ngx_http_gunzip_request_zstd_enc_reset,
+      ngx_http_gunzip_request_zstd_enc_feed,
+      ngx_http_gunzip_request_zstd_enc_destroy,
+      { NULL, NULL },
+      0,
+      NULL },
+    NGX_HTTP_GUNZIP_REQUEST_CODING_ZSTD,
+    1,
+    19,
+    ngx_http_gunzip_request_zstd_enc_level
+};
 
-    rc = inflateEnd(&ctx->zstream);
+#endif
 
-    if (rc != Z_OK) {
-        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
-                      "[gunzreq] inflateEnd() failed: %d", rc);
-        return NGX_ERROR;
-    }
 
-    b = ctx->out_buf;
+#if (NGX_HTTP_GUNZIP_REQUEST_LZ4)
 
-    // update content_length_n
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "[gunzreq] recv_sum=%d", ctx->sum);
-    r->headers_in.content_length_n = ctx->sum;
+/* lz4 is not a registered content coding, upstream has to know it */
 
-    if (ngx_buf_size(b) == 0) {
+static ngx_http_gunzip_request_encoder_t  ngx_http_gunzip_request_lz4_encoder = {
+    { ngx_string("lz4"),
+      ngx_http_gunzip_request_lz4_create,
+      ngx_http_gunzip_request_lz4_reset,
+      ngx_http_gunzip_request_lz4_feed,
+      ngx_http_gunzip_request_lz4_destroy,
+      { NULL, NULL },
+      0,
+      NULL },
+    0,
+    0,
+    12,
+    ngx_http_gunzip_request_lz4_level
+};
 
-        b = ngx_calloc_buf(ctx->request->pool);
-        if (b == NULL) {
-            return NGX_ERROR;
-        }
-    }
+#endif
 
-    cl = ngx_alloc_chain_link(r->pool);
-    if (cl == NULL) {
-        return NGX_ERROR;
-    }
 
-    cl->buf = b;
-    cl->next = NULL;
-    *ctx->last_out = cl;
-    ctx->last_out = &cl->next;
+static ngx_http_gunzip_request_encoder_t  *ngx_http_gunzip_request_encoders[] = {
+#if (NGX_HTTP_GUNZIP_REQUEST_ZSTD_ENCODER)
+    &ngx_http_gunzip_request_zstd_encoder,
+#endif
+#if (NGX_HTTP_GUNZIP_REQUEST_LZ4)
+    &ngx_http_gunzip_request_lz4_encoder,
+#endif
+    NULL
+};
 
-    b->last_buf = (r == r->main) ? 1 : 0;
-    b->last_in_chain = 1;
-    b->sync = 1;
 
-    ctx->done = 1;
+static ngx_http_gunzip_request_engine_t  *ngx_http_gunzip_request_engines[] = {
+    &ngx_http_gunzip_request_zlib_engine,
+#if (NGX_HTTP_GUNZIP_REQUEST_ZLIB_NG)
+    &ngx_http_gunzip_request_zlib_ng_engine,
+#endif
+#if (NGX_HTTP_GUNZIP_REQUEST_ISAL)
+    &ngx_http_gunzip_request_isal_engine,
+#endif
+    NULL
+};
 
-    return NGX_OK;
-}
 
-static ngx_int_t
-ngx_http_gunzip_request_add_data(ngx_http_request_t *r,
-    ngx_http_gunzip_request_ctx_t *ctx)
-{
-    if (ctx->zstream.avail_in || ctx->flush != Z_NO_FLUSH || ctx->redo) {
-        return NGX_OK;
-    }
+static ngx_http_gunzip_request_coding_t  ngx_http_gunzip_request_codings[] = {
+    { ngx_string("gzip"), NGX_HTTP_GUNZIP_REQUEST_CODING_GZIP, NULL },
+    { ngx_string("x-gzip"), NGX_HTTP_GUNZIP_REQUEST_CODING_GZIP, NULL },
+    { ngx_string("deflate"), NGX_HTTP_GUNZIP_REQUEST_CODING_DEFLATE,
+      &ngx_http_gunzip_request_deflate_engine },
+#if (NGX_HTTP_GUNZIP_REQUEST_BROTLI)
+    { ngx_string("br"), NGX_HTTP_GUNZIP_REQUEST_CODING_BR,
+      &ngx_http_gunzip_request_brotli_engine },
+#endif
+#if (NGX_HTTP_GUNZIP_REQUEST_ZSTD)
+    { ngx_string("zstd"), NGX_HTTP_GUNZIP_REQUEST_CODING_ZSTD,
+      &ngx_http_gunzip_request_zstd_engine },
+#endif
+    { ngx_null_string, 0, NULL }
+};
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "[gunzreq] in: %p (%d)", ctx->in, ctx->in != NULL ? ngx_buf_size(ctx->in->buf): -1);
 
-    if (ctx->in == NULL) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] add_data case#5");
-        return NGX_DECLINED;
-    }
+static ngx_conf_bitmask_t  ngx_http_gunzip_request_codings_mask[] = {
+    { ngx_string("gzip"), NGX_HTTP_GUNZIP_REQUEST_CODING_GZIP },
+    { ngx_string("deflate"), NGX_HTTP_GUNZIP_REQUEST_CODING_DEFLATE },
+#if (NGX_HTTP_GUNZIP_REQUEST_BROTLI)
+    { ngx_string("br"), NGX_HTTP_GUNZIP_REQUEST_CODING_BR },
+#endif
+#if (NGX_HTTP_GUNZIP_REQUEST_ZSTD)
+    { ngx_string("zstd"), NGX_HTTP_GUNZIP_REQUEST_CODING_ZSTD },
+#endif
+    { ngx_null_string, 0 }
+};
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "[gunzreq] in#2: size=%d next=%p", ngx_buf_size(ctx->in->buf), ctx->in->next);
+#if (NGX_HTTP_GUNZIP_REQUEST_THREADS)
 
-    ctx->in_buf = ctx->in->buf;
-    ctx->in = ctx->in->next;
+static ngx_conf_num_bounds_t  ngx_http_gunzip_request_parallel_bounds = {
+    ngx_conf_check_num_bounds, 1, NGX_HTTP_GUNZIP_REQUEST_PARTS_MAX
+};
 
-    ctx->zstream.next_in = ctx->in_buf->pos;
-    ctx->zstream.avail_in = ctx->in_buf->last - ctx->in_buf->pos;
+#endif
 
-    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "[gunzreq] in_buf:%p ni:%p ai:%ud",
-                   ctx->in_buf,
-                   ctx->zstream.next_in, ctx->zstream.avail_in);
+static void ngx_http_gunzip_request_exit_process(ngx_cycle_t *cycle);
 
-    if (ctx->in_buf->last_buf || ctx->in_buf->last_in_chain) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] add_data case#1");
-        ctx->flush = Z_FINISH;
 
-    } else if (ctx->in_buf->flush) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] add_data case#2");
-        ctx->flush = Z_SYNC_FLUSH;
+static ngx_command_t  ngx_http_gunzip_request_commands[] = {
 
-    } else if (ctx->zstream.avail_in == 0) {
+    { ngx_string("gunzip_request"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_gunzip_request_enable,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("gunzip_request_buffers"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE2,
+      ngx_conf_set_bufs_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_conf_t, bufs),
+      NULL },
+
+    { ngx_string("gunzip_request_max_inflate_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_conf_t, max_inflate_size),
+      NULL },
+
+    { ngx_string("gunzip_request_max_ratio"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_conf_t, max_ratio),
+      NULL },
+
+    { ngx_string("gunzip_request_codings"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_conf_set_bitmask_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_conf_t, codings),
+      &ngx_http_gunzip_request_codings_mask },
+
+    { ngx_string("gunzip_request_one_shot"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_conf_t, one_shot),
+      NULL },
+
+    { ngx_string("gunzip_request_single_buffer"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_conf_t, single_buffer),
+      NULL },
+
+#if (NGX_HTTP_GUNZIP_REQUEST_NEED_BUFFERING)
+
+    { ngx_string("gunzip_request_slice"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_conf_t, slice),
+      NULL },
+
+#endif
+
+    { ngx_string("gunzip_request_verify_crc"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_conf_t, verify_crc),
+      NULL },
+
+    { ngx_string("gunzip_request_input_batch"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_conf_t, input_batch),
+      NULL },
+
+    { ngx_string("gunzip_request_stream"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_conf_t, stream),
+      NULL },
+
+    { ngx_string("gunzip_request_adaptive_buffers"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_conf_t, adaptive),
+      NULL },
+
+    { ngx_string("gunzip_request_temp_path"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1234,
+      ngx_conf_set_path_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_conf_t, temp_path),
+      NULL },
+
+    { ngx_string("gunzip_request_transcode"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_gunzip_request_transcode,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("gunzip_request_cache_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_gunzip_request_cache_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("gunzip_request_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_gunzip_request_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("gunzip_request_cache_max_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_conf_t, cache_max_size),
+      NULL },
+
+    { ngx_string("gunzip_request_thread_pool"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_gunzip_request_thread_pool,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+#if (NGX_HTTP_GUNZIP_REQUEST_THREADS)
+
+    { ngx_string("gunzip_request_thread_parallel"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_conf_t, thread_parallel),
+      &ngx_http_gunzip_request_parallel_bounds },
+
+#endif
+
+    { ngx_string("gunzip_request_pool_size"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_main_conf_t, pool_size),
+      NULL },
+
+    { ngx_string("gunzip_request_memory_limit"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_gunzip_request_main_conf_t, memory_limit),
+      NULL },
+
+    { ngx_string("gunzip_request_engine"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_gunzip_request_engine,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("gunzip_request_dictionary"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      ngx_http_gunzip_request_dictionary,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("gunzip_request_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_gunzip_request_status,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_gunzip_request_module_ctx = {
+    ngx_http_gunzip_request_add_variables, /* preconfiguration */
+    ngx_http_gunzip_request_init,          /* postconfiguration */
+
+    ngx_http_gunzip_request_create_main_conf,      /* create main configuration */
+    ngx_http_gunzip_request_init_main_conf,        /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_gunzip_request_create_conf,           /* create location configuration */
+    ngx_http_gunzip_request_merge_conf             /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_gunzip_request_module = {
+    NGX_MODULE_V1,
+    &ngx_http_gunzip_request_module_ctx,   /* module context */
+    ngx_http_gunzip_request_commands,      /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    ngx_http_gunzip_request_init_module,   /* init module */
+    ngx_http_gunzip_request_init_process,  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    ngx_http_gunzip_request_exit_process,  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_http_request_body_filter_pt   ngx_http_next_request_body_filter;
+static ngx_http_request_body_filter_pt   ngx_http_next_transcode_filter;
+
+
+/* shared ctx of requests whose bodies are passed as is, never written */
+static ngx_http_gunzip_request_ctx_t  ngx_http_gunzip_request_identity;
+
+/* as nginx hashes request header names */
+static ngx_str_t   ngx_http_gunzip_request_content_encoding =
+    ngx_string("Content-Encoding");
+static ngx_uint_t  ngx_http_gunzip_request_header_hash;
+
+/* names a dictionary of gunzip_request_dictionary */
+static ngx_str_t   ngx_http_gunzip_request_dictionary_id =
+    ngx_string("Dictionary-ID");
+static ngx_uint_t  ngx_http_gunzip_request_dictionary_hash;
+
+/* of the cycle, for DICTID of zlib streams */
+static ngx_array_t  *ngx_http_gunzip_request_dictionaries;
+
+
+static ngx_http_variable_t  ngx_http_gunzip_request_vars[] = {
+
+    { ngx_string("gunzip_request_in_bytes"), NULL,
+      ngx_http_gunzip_request_variable, 0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("gunzip_request_out_bytes"), NULL,
+      ngx_http_gunzip_request_variable, 1, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("gunzip_request_ratio"), NULL,
+      ngx_http_gunzip_request_variable, 2, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("gunzip_request_time"), NULL,
+      ngx_http_gunzip_request_variable, 3, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+      ngx_http_null_variable
+};
+
+
+static ngx_http_gunzip_request_counter_t  ngx_http_gunzip_request_counters[] = {
+    { ngx_string("gunzip_request_requests_total"),
+      ngx_string("Request bodies to decode."),
+      offsetof(ngx_http_gunzip_request_stats_t, requests) },
+    { ngx_string("gunzip_request_in_bytes_total"),
+      ngx_string("Compressed bytes of decoded bodies."),
+      offsetof(ngx_http_gunzip_request_stats_t, in_bytes) },
+    { ngx_string("gunzip_request_out_bytes_total"),
+      ngx_string("Inflated bytes of decoded bodies."),
+      offsetof(ngx_http_gunzip_request_stats_t, out_bytes) },
+    { ngx_string("gunzip_request_errors_total"),
+      ngx_string("Bodies failed to decode."),
+      offsetof(ngx_http_gunzip_request_stats_t, errors) },
+    { ngx_string("gunzip_request_rejected_total"),
+      ngx_string("Bodies rejected with 413."),
+      offsetof(ngx_http_gunzip_request_stats_t, rejected) },
+    { ngx_string("gunzip_request_bombs_total"),
+      ngx_string("Bodies rejected by ISIZE or gunzip_request_max_ratio."),
+      offsetof(ngx_http_gunzip_request_stats_t, bombs) },
+    { ngx_string("gunzip_request_buffers_exhausted_total"),
+      ngx_string("Times gunzip_request_buffers ran out."),
+      offsetof(ngx_http_gunzip_request_stats_t, nomem) },
+    { ngx_string("gunzip_request_backpressure_total"),
+      ngx_string("Times a streamed body waited for upstream to take buffers."),
+      offsetof(ngx_http_gunzip_request_stats_t, waits) },
+    { ngx_string("gunzip_request_pool_hits_total"),
+      ngx_string("Decoders reused from the pool."),
+      offsetof(ngx_http_gunzip_request_stats_t, pool_hits) },
+    { ngx_string("gunzip_request_pool_misses_total"),
+      ngx_string("Decoders created."),
+      offsetof(ngx_http_gunzip_request_stats_t, pool_misses) },
+    { ngx_string("gunzip_request_cache_hits_total"),
+      ngx_string("Bodies served from gunzip_request_cache."),
+      offsetof(ngx_http_gunzip_request_stats_t, cache_hits) },
+    { ngx_string("gunzip_request_cache_misses_total"),
+      ngx_string("Bodies looked up in gunzip_request_cache and inflated."),
+      offsetof(ngx_http_gunzip_request_stats_t, cache_misses) },
+    { ngx_null_string, ngx_null_string, 0 }
+};
+
+
+/* upper bounds of histogram buckets, in microseconds */
+static ngx_uint_t  ngx_http_gunzip_request_buckets[] = {
+    100, 1000, 10000, 100000, 1000000
+};
+
+static ngx_http_gunzip_request_stats_t  *ngx_http_gunzip_request_stats;
+
+#define ngx_http_gunzip_request_stat(name, n)                                 \
+    do {                                                                      \
+        if (ngx_http_gunzip_request_stats) {                                  \
+            (void) ngx_atomic_fetch_add(&ngx_http_gunzip_request_stats->name, \
+                                        n);                                   \
+        }                                                                     \
+    } while (0)
+
+
+/* the free lists themselves are kept in each engine */
+static ngx_uint_t    ngx_http_gunzip_request_pool_size;
+static ngx_uint_t    ngx_http_gunzip_request_pool_hits;
+static ngx_uint_t    ngx_http_gunzip_request_pool_misses;
+
+/*
+ * moving average of inflated / compressed size of this worker, x16, see
+ * gunzip_request_adaptive_buffers; a guess until the first bodies are seen
+ */
+static ngx_uint_t    ngx_http_gunzip_request_ratio =
+                                            NGX_HTTP_GUNZIP_REQUEST_RATIO_INIT;
+
+/* inflated data buffers of this worker, see gunzip_request_memory_limit */
+static size_t        ngx_http_gunzip_request_memory_limit;
+static size_t        ngx_http_gunzip_request_memory;
+
+#if (NGX_HTTP_GUNZIP_REQUEST_LIBDEFLATE)
+/* libdeflate keeps no state between calls, one decompressor per worker */
+static struct libdeflate_decompressor  *ngx_http_gunzip_request_libdeflate;
+#endif
+
+
+static void *
+ngx_http_gunzip_request_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_gunzip_request_main_conf_t  *gmcf;
+
+    gmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_gunzip_request_main_conf_t));
+    if (gmcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     gmcf->engine = NULL;
+     *     gmcf->dictionaries = NULL;
+     */
+
+    gmcf->pool_size = NGX_CONF_UNSET_UINT;
+    gmcf->memory_limit = NGX_CONF_UNSET_SIZE;
+
+    return gmcf;
+}
+
+
+static char *
+ngx_http_gunzip_request_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_gunzip_request_main_conf_t *gmcf = conf;
+
+    if (gmcf->engine == NULL) {
+        gmcf->engine = &ngx_http_gunzip_request_zlib_engine;
+    }
+
+    ngx_conf_init_uint_value(gmcf->pool_size, 32);
+    ngx_conf_init_size_value(gmcf->memory_limit, 0);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_gunzip_request_engine(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_gunzip_request_main_conf_t *gmcf = conf;
+
+    ngx_str_t   *value;
+    ngx_uint_t   i;
+
+    if (gmcf->engine) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    for (i = 0; ngx_http_gunzip_request_engines[i]; i++) {
+        if (ngx_http_gunzip_request_engines[i]->name.len == value[1].len
+            && ngx_strncmp(ngx_http_gunzip_request_engines[i]->name.data,
+                           value[1].data, value[1].len) == 0)
+        {
+            gmcf->engine = ngx_http_gunzip_request_engines[i];
+            return NGX_CONF_OK;
+        }
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "inflate engine \"%V\" is not available, "
+                       "check libraries found by configure", &value[1]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static void *
+ngx_http_gunzip_request_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_gunzip_request_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_gunzip_request_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->enable = NGX_CONF_UNSET;
+
+    conf->max_inflate_size = NGX_CONF_UNSET_SIZE;
+    conf->max_ratio = NGX_CONF_UNSET_UINT;
+    conf->one_shot = NGX_CONF_UNSET;
+    conf->single_buffer = NGX_CONF_UNSET;
+    conf->verify_crc = NGX_CONF_UNSET;
+    conf->input_batch = NGX_CONF_UNSET_SIZE;
+    conf->slice = NGX_CONF_UNSET_SIZE;
+    conf->stream = NGX_CONF_UNSET;
+    conf->adaptive = NGX_CONF_UNSET;
+    conf->transcode = NGX_CONF_UNSET_PTR;
+    conf->transcode_level = NGX_CONF_UNSET;
+    conf->cache_zone = NGX_CONF_UNSET_PTR;
+    conf->cache_max_size = NGX_CONF_UNSET_SIZE;
+
+#if (NGX_HTTP_GUNZIP_REQUEST_THREADS)
+    conf->thread_pool = NGX_CONF_UNSET_PTR;
+    conf->thread_threshold = NGX_CONF_UNSET_SIZE;
+    conf->thread_parallel = NGX_CONF_UNSET_UINT;
+#endif
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->codings = 0;
+     *     conf->temp_path = NULL;
+     */
+
+    return conf;
+}
+
+
+static char *
+ngx_http_gunzip_request_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_gunzip_request_conf_t *prev = parent;
+    ngx_http_gunzip_request_conf_t *conf = child;
+
+    if (conf->enable == NGX_CONF_UNSET) {
+        conf->enable_value = prev->enable_value;
+    }
+
+    ngx_conf_merge_value(conf->enable, prev->enable, 0);
+
+    ngx_conf_merge_bufs_value(conf->bufs, prev->bufs,
+                              (128 * 1024) / ngx_pagesize, ngx_pagesize);
+
+    ngx_conf_merge_size_value(conf->max_inflate_size, prev->max_inflate_size, 0);
+    ngx_conf_merge_uint_value(conf->max_ratio, prev->max_ratio, 0);
+
+    ngx_conf_merge_value(conf->one_shot, prev->one_shot, 1);
+    ngx_conf_merge_value(conf->single_buffer, prev->single_buffer, 0);
+    ngx_conf_merge_value(conf->verify_crc, prev->verify_crc, 1);
+    ngx_conf_merge_size_value(conf->input_batch, prev->input_batch, 0);
+    ngx_conf_merge_size_value(conf->slice, prev->slice, 0);
+    ngx_conf_merge_value(conf->stream, prev->stream, 0);
+
+    ngx_conf_merge_bitmask_value(conf->codings, prev->codings,
+                                 (NGX_CONF_BITMASK_SET
+                                  |NGX_HTTP_GUNZIP_REQUEST_CODING_GZIP));
+
+    ngx_conf_merge_value(conf->adaptive, prev->adaptive, 0);
+
+    /* no default path, spilling is off unless it is set */
+
+    if (conf->temp_path == NULL) {
+        conf->temp_path = prev->temp_path;
+    }
+
+    ngx_conf_merge_ptr_value(conf->transcode, prev->transcode, NULL);
+    ngx_conf_merge_value(conf->transcode_level, prev->transcode_level, 0);
+
+    ngx_conf_merge_ptr_value(conf->cache_zone, prev->cache_zone, NULL);
+    ngx_conf_merge_size_value(conf->cache_max_size, prev->cache_max_size,
+                              16 * 1024);
+
+#if (NGX_HTTP_GUNZIP_REQUEST_THREADS)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+    ngx_conf_merge_size_value(conf->thread_threshold, prev->thread_threshold,
+                              256 * 1024);
+    ngx_conf_merge_uint_value(conf->thread_parallel, prev->thread_parallel, 1);
+#endif
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_gunzip_request_enable(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_gunzip_request_conf_t *gcf = conf;
+
+    ngx_str_t                         *value;
+    ngx_http_compile_complex_value_t   ccv;
+
+    if (gcf->enable != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcasecmp(value[1].data, (u_char *) "on") == 0) {
+        gcf->enable = 1;
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strcasecmp(value[1].data, (u_char *) "off") == 0) {
+        gcf->enable = 0;
+        return NGX_CONF_OK;
+    }
+
+    /* a variable, "", "0" and "off" turn the module off for a request */
+
+    gcf->enable_value = ngx_palloc(cf->pool,
+                                    sizeof(ngx_http_complex_value_t));
+    if (gcf->enable_value == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[1];
+    ccv.complex_value = gcf->enable_value;
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (gcf->enable_value->lengths == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\", it must be \"on\", "
+                           "\"off\" or contain variables", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    gcf->enable = 1;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_gunzip_request_transcode(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_gunzip_request_conf_t *gcf = conf;
+
+    ngx_int_t                           level;
+    ngx_str_t                          *value;
+    ngx_uint_t                          i;
+    ngx_http_gunzip_request_encoder_t  *enc;
+
+    if (gcf->transcode != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        if (cf->args->nelts > 2) {
+            return "is invalid";
+        }
+
+        gcf->transcode = NULL;
+        return NGX_CONF_OK;
+    }
+
+    for (i = 0; ngx_http_gunzip_request_encoders[i]; i++) {
+        enc = ngx_http_gunzip_request_encoders[i];
+
+        if (enc->engine.name.len == value[1].len
+            && ngx_strncmp(enc->engine.name.data, value[1].data,
+                           value[1].len) == 0)
+        {
+            break;
+        }
+    }
+
+    enc = ngx_http_gunzip_request_encoders[i];
+
+    if (enc == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "encoder \"%V\" is not available, "
+                           "check libraries found by configure", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    level = enc->default_level;
+
+    if (cf->args->nelts > 2) {
+        level = ngx_atoi(value[2].data, value[2].len);
+
+        if (level == NGX_ERROR || level > enc->max_level) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid level \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    gcf->transcode = enc;
+    gcf->transcode_level = level;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_gunzip_request_dictionary(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_gunzip_request_main_conf_t *gmcf = conf;
+
+    u_char                          *p;
+    size_t                           size;
+    ngx_fd_t                         fd;
+    ngx_str_t                       *value, id;
+    ngx_uint_t                       i;
+    ngx_file_info_t                  fi;
+    ngx_pool_cleanup_t              *cln;
+    ngx_http_gunzip_request_dict_t  *dict;
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts > 2) {
+        id = value[2];
+
+    } else {
+        /* the file name without directories */
+
+        id = value[1];
+
+        p = (u_char *) ngx_strlchr(id.data, id.data + id.len, '/');
+
+        while (p) {
+            id.len -= p + 1 - id.data;
+            id.data = p + 1;
+            p = (u_char *) ngx_strlchr(id.data, id.data + id.len, '/');
+        }
+    }
+
+    if (gmcf->dictionaries == NULL) {
+        gmcf->dictionaries = ngx_array_create(cf->pool, 4,
+                                       sizeof(ngx_http_gunzip_request_dict_t));
+        if (gmcf->dictionaries == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    dict = gmcf->dictionaries->elts;
+
+    for (i = 0; i < gmcf->dictionaries->nelts; i++) {
+        if (dict[i].id.len == id.len
+            && ngx_strncmp(dict[i].id.data, id.data, id.len) == 0)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "duplicate dictionary \"%V\"", &id);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    if (ngx_conf_full_name(cf->cycle, &value[1], 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    fd = ngx_open_file(value[1].data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_open_file_n " \"%s\" failed", value[1].data);
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_fd_info_n " \"%s\" failed", value[1].data);
+        (void) ngx_close_file(fd);
+        return NGX_CONF_ERROR;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    if (size == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "dictionary \"%s\" is empty", value[1].data);
+        (void) ngx_close_file(fd);
+        return NGX_CONF_ERROR;
+    }
+
+    /* mapped read only, workers share the pages of the page cache */
+
+    p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_ALERT, cf, ngx_errno,
+                           ngx_close_file_n " \"%s\" failed", value[1].data);
+    }
+
+    if (p == MAP_FAILED) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           "mmap(\"%s\") failed", value[1].data);
+        return NGX_CONF_ERROR;
+    }
+
+    dict = ngx_array_push(gmcf->dictionaries);
+    if (dict == NULL) {
+        (void) munmap(p, size);
+        return NGX_CONF_ERROR;
+    }
+
+    dict->id = id;
+    dict->data = p;
+    dict->len = size;
+    dict->adler = adler32(adler32(0, Z_NULL, 0), p, size);
+    dict->ddict = NULL;
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        (void) munmap(p, size);
+        return NGX_CONF_ERROR;
+    }
+
+#if (NGX_HTTP_GUNZIP_REQUEST_ZSTD)
+
+    /* a copy, digested once by the master process */
+
+    dict->ddict = ZSTD_createDDict(p, size);
+    if (dict->ddict == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "ZSTD_createDDict(\"%s\") failed", value[1].data);
+        (void) munmap(p, size);
+        return NGX_CONF_ERROR;
+    }
+
+#endif
+
+    cln->handler = ngx_http_gunzip_request_dictionary_cleanup;
+    cln->data = dict;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "[gunzreq] dictionary \"%V\": %uz bytes, DICTID %08xD",
+                   &dict->id, size, dict->adler);
+
+    return NGX_CONF_OK;
+}
+
+
+static void
+ngx_http_gunzip_request_dictionary_cleanup(void *data)
+{
+    ngx_http_gunzip_request_dict_t *dict = data;
+
+#if (NGX_HTTP_GUNZIP_REQUEST_ZSTD)
+    ZSTD_freeDDict(dict->ddict);
+#endif
+
+    (void) munmap(dict->data, dict->len);
+}
+
+
+static char *
+ngx_http_gunzip_request_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    u_char                           *p;
+    ssize_t                           size;
+    ngx_str_t                        *value, name, s;
+    ngx_shm_zone_t                   *shm_zone;
+    ngx_http_gunzip_request_cache_t  *cache;
+
+    value = cf->args->elts;
+
+    p = (u_char *) ngx_strchr(value[1].data, ':');
+
+    if (p == NULL || p == value[1].data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone \"%V\", \"name:size\" is expected",
+                           &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.data = value[1].data;
+    name.len = p - value[1].data;
+
+    s.data = p + 1;
+    s.len = value[1].data + value[1].len - s.data;
+
+    size = ngx_parse_size(&s);
+
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_gunzip_request_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate zone \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_gunzip_request_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_http_gunzip_request_cache_init_zone;
+    shm_zone->data = cache;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_gunzip_request_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_gunzip_request_conf_t *gcf = conf;
+
+    ngx_str_t  *value;
+
+    if (gcf->cache_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        gcf->cache_zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    /* the size is set by gunzip_request_cache_zone, maybe later */
+
+    gcf->cache_zone = ngx_shared_memory_add(cf, &value[1], 0,
+                                            &ngx_http_gunzip_request_module);
+    if (gcf->cache_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_gunzip_request_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+#if (NGX_HTTP_GUNZIP_REQUEST_THREADS)
+    ngx_http_gunzip_request_conf_t *gcf = conf;
+
+    ssize_t     size;
+    ngx_str_t  *value;
+
+    if (gcf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        if (cf->args->nelts > 2) {
+            return "is invalid";
+        }
+
+        gcf->thread_pool = NULL;
+        return NGX_CONF_OK;
+    }
+
+    gcf->thread_pool = ngx_thread_pool_add(cf, &value[1]);
+    if (gcf->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (cf->args->nelts > 2) {
+        size = ngx_parse_size(&value[2]);
+        if (size == NGX_ERROR) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid threshold \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        gcf->thread_threshold = size;
+    }
+
+    return NGX_CONF_OK;
+
+#else
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"gunzip_request_thread_pool\" requires nginx 1.21.2 "
+                       "or later built with --with-threads");
+
+    return NGX_CONF_ERROR;
+
+#endif
+}
+
+
+static char *
+ngx_http_gunzip_request_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_str_t                             name;
+    ngx_http_core_loc_conf_t             *clcf;
+    ngx_http_gunzip_request_main_conf_t  *gmcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_gunzip_request_status_handler;
+
+    /* counters are kept only when they can be seen */
+
+    gmcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_gunzip_request_module);
+
+    if (gmcf->shm_zone) {
+        return NGX_CONF_OK;
+    }
+
+    ngx_str_set(&name, "gunzip_request");
+
+    gmcf->shm_zone = ngx_shared_memory_add(cf, &name, 8 * ngx_pagesize,
+                                           &ngx_http_gunzip_request_module);
+    if (gmcf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    gmcf->shm_zone->init = ngx_http_gunzip_request_init_zone;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_slab_pool_t                  *shpool;
+    ngx_http_gunzip_request_stats_t  *stats;
+
+    if (data) {
+        /* counters survive reloads */
+        shm_zone->data = data;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
+    }
+
+    stats = ngx_slab_calloc(shpool, sizeof(ngx_http_gunzip_request_stats_t));
+    if (stats == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = stats;
+    shm_zone->data = stats;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_gunzip_request_cache_t  *ocache = data;
+
+    size_t                            len;
+    ngx_http_gunzip_request_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_http_gunzip_request_cache_sh_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_http_gunzip_request_cache_insert);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    len = sizeof(" in gunzip_request_cache_zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx,
+                " in gunzip_request_cache_zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* a full zone is the normal case, old entries are evicted */
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_gunzip_request_alloc(void *opaque, u_int items, u_int size)
+{
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "[gunzreq] gunzip alloc: n:%ud s:%ud",
+                   items, size);
+
+    /* pooled streams outlive requests, so they can't use r->pool */
+    return ngx_alloc(items * size, ngx_cycle->log);
+}
+
+
+static void
+ngx_http_gunzip_request_free(void *opaque, void *address)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "[gunzreq] gunzip free: %p", address);
+
+    ngx_free(address);
+}
+
+
+/*
+ * the gzip wrapper is parsed here and zlib inflates raw deflate data, so
+ * the CRC-32 of the trailer is computed by ngx_http_gunzip_request_crc32(),
+ * or not at all with gunzip_request_verify_crc off
+ */
+
+#define NGX_HTTP_GUNZIP_REQUEST_FHCRC     0x02
+#define NGX_HTTP_GUNZIP_REQUEST_FEXTRA    0x04
+#define NGX_HTTP_GUNZIP_REQUEST_FNAME     0x08
+#define NGX_HTTP_GUNZIP_REQUEST_FCOMMENT  0x10
+
+typedef enum {
+    ngx_gzip_id1 = 0,
+    ngx_gzip_id2,
+    ngx_gzip_cm,
+    ngx_gzip_flg,
+    ngx_gzip_skip,
+    ngx_gzip_xlen,
+    ngx_gzip_string,
+    ngx_gzip_data,
+    ngx_gzip_trailer
+} ngx_http_gunzip_request_gzip_state_e;
+
+
+typedef struct {
+    z_stream             zstream;
+    ngx_uint_t           state;
+    ngx_uint_t           flags;
+    size_t               skip;
+    ngx_uint_t           n;
+    uint32_t             crc;
+    uint32_t             size;
+    u_char               trailer[8];
+} ngx_http_gunzip_request_gzip_t;
+
+
+static void *
+ngx_http_gunzip_request_zlib_create(ngx_log_t *log)
+{
+    int                              rc;
+    ngx_http_gunzip_request_gzip_t  *g;
+
+    g = ngx_calloc(sizeof(ngx_http_gunzip_request_gzip_t), log);
+    if (g == NULL) {
+        return NULL;
+    }
+
+    g->zstream.zalloc = ngx_http_gunzip_request_alloc;
+    g->zstream.zfree = ngx_http_gunzip_request_free;
+    g->zstream.opaque = Z_NULL;
+
+    /* raw deflate, the gzip header and trailer are ours */
+    rc = inflateInit2(&g->zstream, -MAX_WBITS);
+
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "[gunzreq] inflateInit2() failed: %d", rc);
+        ngx_free(g);
+        return NULL;
+    }
+
+    return g;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_zlib_reset(void *data, ngx_log_t *log)
+{
+    int                              rc;
+    ngx_http_gunzip_request_gzip_t  *g = data;
+
+    rc = inflateReset(&g->zstream);
+
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "[gunzreq] inflateReset() failed: %d", rc);
+        return NGX_ERROR;
+    }
+
+    g->state = ngx_gzip_id1;
+    g->crc = 0;
+    g->size = 0;
+
+    return NGX_OK;
+}
+
+
+/* the optional fields in the order they follow MTIME, XFL and OS */
+
+static ngx_uint_t
+ngx_http_gunzip_request_gzip_next(ngx_http_gunzip_request_gzip_t *g)
+{
+    if (g->flags & NGX_HTTP_GUNZIP_REQUEST_FEXTRA) {
+        g->flags &= ~NGX_HTTP_GUNZIP_REQUEST_FEXTRA;
+        g->skip = 0;
+        g->n = 0;
+        return ngx_gzip_xlen;
+    }
+
+    if (g->flags & NGX_HTTP_GUNZIP_REQUEST_FNAME) {
+        g->flags &= ~NGX_HTTP_GUNZIP_REQUEST_FNAME;
+        return ngx_gzip_string;
+    }
+
+    if (g->flags & NGX_HTTP_GUNZIP_REQUEST_FCOMMENT) {
+        g->flags &= ~NGX_HTTP_GUNZIP_REQUEST_FCOMMENT;
+        return ngx_gzip_string;
+    }
+
+    if (g->flags & NGX_HTTP_GUNZIP_REQUEST_FHCRC) {
+        g->flags &= ~NGX_HTTP_GUNZIP_REQUEST_FHCRC;
+        g->skip = 2;
+        return ngx_gzip_skip;
+    }
+
+    return ngx_gzip_data;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_gzip_header(ngx_http_gunzip_request_gzip_t *g,
+    ngx_http_gunzip_request_io_t *io, ngx_log_t *log)
+{
+    u_char  ch;
+
+    while (io->avail_in && g->state != ngx_gzip_data) {
+        ch = *io->next_in++;
+        io->avail_in--;
+
+        switch (g->state) {
+
+        case ngx_gzip_id1:
+            if (ch != 0x1f) {
+                goto invalid;
+            }
+
+            g->state = ngx_gzip_id2;
+            break;
+
+        case ngx_gzip_id2:
+            if (ch != 0x8b) {
+                goto invalid;
+            }
+
+            g->state = ngx_gzip_cm;
+            break;
+
+        case ngx_gzip_cm:
+            if (ch != Z_DEFLATED) {
+                goto invalid;
+            }
+
+            g->state = ngx_gzip_flg;
+            break;
+
+        case ngx_gzip_flg:
+            if (ch & 0xe0) {
+                /* reserved flags */
+                goto invalid;
+            }
+
+            g->flags = ch;
+            g->skip = 6;
+            g->state = ngx_gzip_skip;
+            break;
+
+        case ngx_gzip_skip:
+            if (--g->skip == 0) {
+                g->state = ngx_http_gunzip_request_gzip_next(g);
+            }
+
+            break;
+
+        case ngx_gzip_xlen:
+            g->skip |= (size_t) ch << (8 * g->n);
+
+            if (++g->n < 2) {
+                break;
+            }
+
+            g->state = g->skip ? ngx_gzip_skip
+                               : ngx_http_gunzip_request_gzip_next(g);
+            break;
+
+        case ngx_gzip_string:
+            if (ch == '\0') {
+                g->state = ngx_http_gunzip_request_gzip_next(g);
+            }
+
+            break;
+        }
+    }
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, log, 0, "[gunzreq] invalid gzip header");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_gzip_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log)
+{
+    u_char                          *out;
+    uint32_t                         crc, size;
+    ngx_int_t                        rc;
+    ngx_http_gunzip_request_gzip_t  *g = data;
+
+    if (g->state < ngx_gzip_data) {
+        if (ngx_http_gunzip_request_gzip_header(g, io, log) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (g->state != ngx_gzip_data) {
+            return NGX_OK;
+        }
+    }
+
+    if (g->state == ngx_gzip_data) {
+        out = io->next_out;
+
+        rc = ngx_http_gunzip_request_zlib_feed(&g->zstream, io, flush, log);
+
+        if (rc != NGX_OK && rc != NGX_DONE) {
+            return NGX_ERROR;
+        }
+
+        if (!io->skip_crc) {
+            g->crc = ngx_http_gunzip_request_crc32(g->crc, out,
+                                                   io->next_out - out);
+        }
+
+        g->size += (uint32_t) (io->next_out - out);
+
+        if (rc == NGX_OK) {
+            return NGX_OK;
+        }
+
+        g->state = ngx_gzip_trailer;
+        g->n = 0;
+    }
+
+    while (io->avail_in && g->n < 8) {
+        g->trailer[g->n++] = *io->next_in++;
+        io->avail_in--;
+    }
+
+    if (g->n < 8) {
+        return NGX_OK;
+    }
+
+    crc = g->trailer[0] | g->trailer[1] << 8 | g->trailer[2] << 16
+          | (uint32_t) g->trailer[3] << 24;
+    size = g->trailer[4] | g->trailer[5] << 8 | g->trailer[6] << 16
+           | (uint32_t) g->trailer[7] << 24;
+
+    if (size != g->size) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "[gunzreq] gzip ISIZE %uD, inflated %uD",
+                      size, g->size);
+        return NGX_ERROR;
+    }
+
+    if (!io->skip_crc && crc != g->crc) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "[gunzreq] gzip CRC32 %08xD, inflated %08xD",
+                      crc, g->crc);
+        return NGX_ERROR;
+    }
+
+    return NGX_DONE;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_zlib_feed(void *data, ngx_http_gunzip_request_io_t *io,
+    ngx_uint_t flush, ngx_log_t *log)
+{
+    int        rc;
+    z_stream  *zs = data;
+
+    zs->next_in = io->next_in;
+    zs->avail_in = io->avail_in;
+    zs->next_out = io->next_out;
+    zs->avail_out = io->avail_out;
+
+    rc = inflate(zs, flush == NGX_HTTP_GUNZIP_REQUEST_FINISH ? Z_FINISH
+                     : flush == NGX_HTTP_GUNZIP_REQUEST_SYNC_FLUSH
+                     ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+
+    io->next_in = zs->next_in;
+    io->avail_in = zs->avail_in;
+    io->next_out = zs->next_out;
+    io->avail_out = zs->avail_out;
+
+    if (rc == Z_STREAM_END) {
+        return NGX_DONE;
+    }
+
+    if (rc == Z_NEED_DICT) {
+        /* zlib format only, see ngx_http_gunzip_request_deflate_feed() */
+        return NGX_DECLINED;
+    }
+
+    if (rc != Z_OK && rc != Z_BUF_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "[gunzreq] inflate() failed: %ui, %d", flush, rc);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gunzip_request_zlib_destroy(void *data)
+{
+    (void) inflateEnd(data);
+    ngx_free(data);
+}
+
+
+typedef struct {
+    z_stream             zstream;
+    /* 1 before the header, 2 with its first byte in "first" */
+    ngx_uint_t           header;
+    u_char               first;
+    ngx_http_gunzip_request_dict_t  *dict;
+} ngx_http_gunzip_request_deflate_t;
+
+
+static void *
+ngx_http_gunzip_request_deflate_create(ngx_log_t *log)
+{
+    int                                 rc;
+    ngx_http_gunzip_request_deflate_t  *d;
+
+    d = ngx_calloc(sizeof(ngx_http_gunzip_request_deflate_t), log);
+    if (d == NULL) {
+        return NULL;
+    }
+
+    d->zstream.zalloc = ngx_http_gunzip_request_alloc;
+    d->zstream.zfree = ngx_http_gunzip_request_free;
+    d->zstream.opaque = Z_NULL;
+
+    rc = inflateInit2(&d->zstream, MAX_WBITS);
+
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "[gunzreq] inflateInit2() failed: %d", rc);
+        ngx_free(d);
+        return NULL;
+    }
+
+    d->header = 1;
+
+    return d;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_deflate_reset(void *data, ngx_log_t *log)
+{
+    ngx_http_gunzip_request_deflate_t *d = data;
+
+    int  rc;
+
+    rc = inflateReset2(&d->zstream, MAX_WBITS);
+
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "[gunzreq] inflateReset2() failed: %d", rc);
+        return NGX_ERROR;
+    }
+
+    d->header = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_deflate_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log)
+{
+    ngx_http_gunzip_request_deflate_t *d = data;
+
+    int                              rc;
+    ngx_int_t                        n;
+    ngx_uint_t                       i, c, held;
+    ngx_http_gunzip_request_io_t     one;
+    ngx_http_gunzip_request_dict_t  *dict;
+
+    /*
+     * "deflate" is zlib format (RFC 1950), but some clients send raw
+     * deflate data; a zlib stream starts with CM 8 and CINFO up to 7, and
+     * its first two bytes are a multiple of 31 (FCHECK)
+     */
+
+    if (d->header && io->avail_in) {
+
+        if (d->header == 1 && io->avail_in == 1
+            && flush != NGX_HTTP_GUNZIP_REQUEST_FINISH)
+        {
+            /* the second byte decides, the first one is kept until then */
+
+            d->first = *io->next_in++;
+            io->avail_in--;
+            d->header = 2;
+
+            return NGX_OK;
+        }
+
+        held = (d->header == 2);
+        d->header = 0;
+
+        if (held) {
+            c = (ngx_uint_t) d->first << 8 | io->next_in[0];
+
+        } else if (io->avail_in > 1) {
+            c = (ngx_uint_t) io->next_in[0] << 8 | io->next_in[1];
+
+        } else {
+            /* a single byte is not a zlib stream */
+            c = 0;
+        }
+
+        if (((c >> 8) & 0x0f) != Z_DEFLATED || (c >> 12) + 8 > MAX_WBITS
+            || c % 31 != 0)
+        {
+
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0,
+                           "[gunzreq] raw deflate");
+
+            rc = inflateReset2(&d->zstream, -MAX_WBITS);
+
+            if (rc != Z_OK) {
+                ngx_log_error(NGX_LOG_ALERT, log, 0,
+                              "[gunzreq] inflateReset2() failed: %d", rc);
+                return NGX_ERROR;
+            }
+
+            /* raw data can't ask for a dictionary, it is set up front */
+
+            if (d->dict) {
+                rc = inflateSetDictionary(&d->zstream, d->dict->data,
+                                          d->dict->len);
+
+                if (rc != Z_OK) {
+                    ngx_log_error(NGX_LOG_ALERT, log, 0,
+                                  "[gunzreq] inflateSetDictionary() failed: %d",
+                                  rc);
+                    return NGX_ERROR;
+                }
+            }
+        }
+
+        if (held) {
+            one = *io;
+            one.next_in = &d->first;
+            one.avail_in = 1;
+
+            if (ngx_http_gunzip_request_zlib_feed(&d->zstream, &one,
+                                            NGX_HTTP_GUNZIP_REQUEST_NO_FLUSH,
+                                            log)
+                == NGX_ERROR)
+            {
+                return NGX_ERROR;
+            }
+
+            io->next_out = one.next_out;
+            io->avail_out = one.avail_out;
+        }
+    }
+
+    n = ngx_http_gunzip_request_zlib_feed(&d->zstream, io, flush, log);
+
+    if (n != NGX_DECLINED) {
+        return n;
+    }
+
+    /*
+     * zlib format names its dictionary by DICTID, which is left in adler;
+     * the one of Dictionary-ID goes first
+     */
+
+    dict = NULL;
+
+    if (d->dict && d->dict->adler == d->zstream.adler) {
+        dict = d->dict;
+
+    } else if (ngx_http_gunzip_request_dictionaries) {
+        dict = ngx_http_gunzip_request_dictionaries->elts;
+
+        for (i = 0; i < ngx_http_gunzip_request_dictionaries->nelts; i++) {
+            if (dict[i].adler == d->zstream.adler) {
+                break;
+            }
+        }
+
+        dict = (i < ngx_http_gunzip_request_dictionaries->nelts) ? &dict[i]
+                                                                 : NULL;
+    }
+
+    if (dict == NULL) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "[gunzreq] no dictionary for DICTID %08xD",
+                      (uint32_t) d->zstream.adler);
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "[gunzreq] dictionary \"%V\"", &dict->id);
+
+    rc = inflateSetDictionary(&d->zstream, dict->data, dict->len);
+
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "[gunzreq] inflateSetDictionary() failed: %d", rc);
+        return NGX_ERROR;
+    }
+
+    return ngx_http_gunzip_request_zlib_feed(&d->zstream, io, flush, log);
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_deflate_dictionary(void *data,
+    ngx_http_gunzip_request_dict_t *dict, ngx_log_t *log)
+{
+    ngx_http_gunzip_request_deflate_t *d = data;
+
+    d->dict = dict;
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HTTP_GUNZIP_REQUEST_BROTLI)
+
+typedef struct {
+    BrotliDecoderState  *state;
+} ngx_http_gunzip_request_brotli_t;
+
+
+static void *
+ngx_http_gunzip_request_brotli_create(ngx_log_t *log)
+{
+    ngx_http_gunzip_request_brotli_t  *b;
+
+    b = ngx_alloc(sizeof(ngx_http_gunzip_request_brotli_t), log);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->state = BrotliDecoderCreateInstance(NULL, NULL, NULL);
+
+    if (b->state == NULL) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "[gunzreq] BrotliDecoderCreateInstance() failed");
+        ngx_free(b);
+        return NULL;
+    }
+
+    return b;
+}
+
+
+
+static ngx_int_t
+ngx_http_gunzip_request_brotli_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log)
+{
+    ngx_http_gunzip_request_brotli_t *b = data;
+
+    const uint8_t             *next_in;
+    BrotliDecoderResult        rc;
+
+    next_in = io->next_in;
+
+    rc = BrotliDecoderDecompressStream(b->state, &io->avail_in, &next_in,
+                                       &io->avail_out, &io->next_out, NULL);
+
+    io->next_in = (u_char *) next_in;
+
+    if (rc == BROTLI_DECODER_RESULT_SUCCESS) {
+        return NGX_DONE;
+    }
+
+    if (rc == BROTLI_DECODER_RESULT_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "[gunzreq] BrotliDecoderDecompressStream() failed: %s",
+                      BrotliDecoderErrorString(
+                          BrotliDecoderGetErrorCode(b->state)));
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gunzip_request_brotli_destroy(void *data)
+{
+    ngx_http_gunzip_request_brotli_t *b = data;
+
+    BrotliDecoderDestroyInstance(b->state);
+    ngx_free(b);
+}
+
+#endif
+
+
+#if (NGX_HTTP_GUNZIP_REQUEST_ZSTD)
+
+static void *
+ngx_http_gunzip_request_zstd_create(ngx_log_t *log)
+{
+    size_t          rc;
+    ZSTD_DStream   *ds;
+
+    ds = ZSTD_createDStream();
+    if (ds == NULL) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "[gunzreq] ZSTD_createDStream() failed");
+        return NULL;
+    }
+
+    /* 8MB window at most, as RFC 8878 suggests for HTTP */
+
+    rc = ZSTD_DCtx_setParameter(ds, ZSTD_d_windowLogMax, 23);
+
+    if (ZSTD_isError(rc)) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "[gunzreq] ZSTD_DCtx_setParameter() failed: %s",
+                      ZSTD_getErrorName(rc));
+        ZSTD_freeDStream(ds);
+        return NULL;
+    }
+
+    return ds;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_zstd_reset(void *data, ngx_log_t *log)
+{
+    size_t  rc;
+
+    rc = ZSTD_DCtx_reset(data, ZSTD_reset_session_only);
+
+    if (ZSTD_isError(rc)) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "[gunzreq] ZSTD_DCtx_reset() failed: %s",
+                      ZSTD_getErrorName(rc));
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_zstd_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log)
+{
+    size_t           rc;
+    ZSTD_inBuffer    in;
+    ZSTD_outBuffer   out;
+
+    in.src = io->next_in;
+    in.size = io->avail_in;
+    in.pos = 0;
+
+    out.dst = io->next_out;
+    out.size = io->avail_out;
+    out.pos = 0;
+
+    rc = ZSTD_decompressStream(data, &out, &in);
+
+    io->next_in += in.pos;
+    io->avail_in -= in.pos;
+    io->next_out += out.pos;
+    io->avail_out -= out.pos;
+
+    if (ZSTD_isError(rc)) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "[gunzreq] ZSTD_decompressStream() failed: %s",
+                      ZSTD_getErrorName(rc));
+        return NGX_ERROR;
+    }
+
+    /* 0 means a frame is completely decoded and flushed */
+
+    if (rc == 0) {
+        return NGX_DONE;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gunzip_request_zstd_destroy(void *data)
+{
+    ZSTD_freeDStream(data);
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_zstd_dictionary(void *data,
+    ngx_http_gunzip_request_dict_t *dict, ngx_log_t *log)
+{
+    size_t  rc;
+
+    /* it stays referenced over ZSTD_DCtx_reset(), so NULL is set too */
+
+    rc = ZSTD_DCtx_refDDict(data, dict ? dict->ddict : NULL);
+
+    if (ZSTD_isError(rc)) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "[gunzreq] ZSTD_DCtx_refDDict() failed: %s",
+                      ZSTD_getErrorName(rc));
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+#if (NGX_HTTP_GUNZIP_REQUEST_ZSTD_ENCODER)
+
+static void *
+ngx_http_gunzip_request_zstd_enc_create(ngx_log_t *log)
+{
+    ZSTD_CCtx  *cc;
+
+    cc = ZSTD_createCCtx();
+    if (cc == NULL) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "[gunzreq] ZSTD_createCCtx() failed");
+        return NULL;
+    }
+
+    return cc;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_zstd_enc_reset(void *data, ngx_log_t *log)
+{
+    size_t  rc;
+
+    rc = ZSTD_CCtx_reset(data, ZSTD_reset_session_only);
+
+    if (ZSTD_isError(rc)) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "[gunzreq] ZSTD_CCtx_reset() failed: %s",
+                      ZSTD_getErrorName(rc));
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_zstd_enc_level(void *data, ngx_int_t level,
+    ngx_log_t *log)
+{
+    size_t  rc;
+
+    rc = ZSTD_CCtx_setParameter(data, ZSTD_c_compressionLevel, (int) level);
+
+    if (ZSTD_isError(rc)) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "[gunzreq] ZSTD_CCtx_setParameter() failed: %s",
+                      ZSTD_getErrorName(rc));
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_zstd_enc_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log)
+{
+    size_t              rc;
+    ZSTD_inBuffer       in;
+    ZSTD_outBuffer      out;
+    ZSTD_EndDirective   mode;
+
+    in.src = io->next_in;
+    in.size = io->avail_in;
+    in.pos = 0;
+
+    out.dst = io->next_out;
+    out.size = io->avail_out;
+    out.pos = 0;
+
+    mode = flush == NGX_HTTP_GUNZIP_REQUEST_FINISH ? ZSTD_e_end
+           : flush == NGX_HTTP_GUNZIP_REQUEST_SYNC_FLUSH ? ZSTD_e_flush
+           : ZSTD_e_continue;
+
+    rc = ZSTD_compressStream2(data, &out, &in, mode);
+
+    io->next_in += in.pos;
+    io->avail_in -= in.pos;
+    io->next_out += out.pos;
+    io->avail_out -= out.pos;
+
+    if (ZSTD_isError(rc)) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "[gunzreq] ZSTD_compressStream2() failed: %s",
+                      ZSTD_getErrorName(rc));
+        return NGX_ERROR;
+    }
+
+    /* with flush or end, rc is the number of bytes still to be written */
+
+    if (io->avail_in || (mode != ZSTD_e_continue && rc != 0)) {
+        return NGX_AGAIN;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gunzip_request_zstd_enc_destroy(void *data)
+{
+    ZSTD_freeCCtx(data);
+}
+
+#endif
+
+
+#if (NGX_HTTP_GUNZIP_REQUEST_LZ4)
+
+typedef struct {
+    LZ4F_cctx           *cctx;
+    LZ4F_preferences_t   prefs;
+    ngx_uint_t           begun;
+} ngx_http_gunzip_request_lz4_t;
+
+
+static void *
+ngx_http_gunzip_request_lz4_create(ngx_log_t *log)
+{
+    size_t                          rc;
+    ngx_http_gunzip_request_lz4_t  *lz;
+
+    lz = ngx_calloc(sizeof(ngx_http_gunzip_request_lz4_t), log);
+    if (lz == NULL) {
+        return NULL;
+    }
+
+    rc = LZ4F_createCompressionContext(&lz->cctx, LZ4F_VERSION);
+
+    if (LZ4F_isError(rc)) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "[gunzreq] LZ4F_createCompressionContext() failed: %s",
+                      LZ4F_getErrorName(rc));
+        ngx_free(lz);
+        return NULL;
+    }
+
+    /* every update is written out whole, so a flush has nothing to do */
+
+    lz->prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+    lz->prefs.autoFlush = 1;
+
+    return lz;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_lz4_reset(void *data, ngx_log_t *log)
+{
+    ngx_http_gunzip_request_lz4_t *lz = data;
+
+    /* LZ4F_compressBegin() starts a new frame over anything left */
+    lz->begun = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_lz4_level(void *data, ngx_int_t level, ngx_log_t *log)
+{
+    ngx_http_gunzip_request_lz4_t *lz = data;
+
+    lz->prefs.compressionLevel = (int) level;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_lz4_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log)
+{
+    ngx_http_gunzip_request_lz4_t *lz = data;
+
+    size_t  rc, size;
+
+    if (!lz->begun) {
+        if (io->avail_out < LZ4F_HEADER_SIZE_MAX) {
+            return NGX_AGAIN;
+        }
+
+        rc = LZ4F_compressBegin(lz->cctx, io->next_out, io->avail_out,
+                                &lz->prefs);
+
+        if (LZ4F_isError(rc)) {
+            ngx_log_error(NGX_LOG_ERR, log, 0,
+                          "[gunzreq] LZ4F_compressBegin() failed: %s",
+                          LZ4F_getErrorName(rc));
+            return NGX_ERROR;
+        }
+
+        io->next_out += rc;
+        io->avail_out -= rc;
+
+        lz->begun = 1;
+    }
+
+    /* LZ4F wants room for the worst case of each call */
+
+    while (io->avail_in) {
+        size = ngx_min(io->avail_in, NGX_HTTP_GUNZIP_REQUEST_LZ4_BLOCK);
+
+        if (io->avail_out < LZ4F_compressBound(size, &lz->prefs)) {
+            return NGX_AGAIN;
+        }
+
+        rc = LZ4F_compressUpdate(lz->cctx, io->next_out, io->avail_out,
+                                 io->next_in, size, NULL);
+
+        if (LZ4F_isError(rc)) {
+            ngx_log_error(NGX_LOG_ERR, log, 0,
+                          "[gunzreq] LZ4F_compressUpdate() failed: %s",
+                          LZ4F_getErrorName(rc));
+            return NGX_ERROR;
+        }
+
+        io->next_in += size;
+        io->avail_in -= size;
+        io->next_out += rc;
+        io->avail_out -= rc;
+    }
+
+    if (flush != NGX_HTTP_GUNZIP_REQUEST_FINISH) {
+        return NGX_OK;
+    }
+
+    if (io->avail_out < LZ4F_compressBound(0, &lz->prefs)) {
+        return NGX_AGAIN;
+    }
+
+    rc = LZ4F_compressEnd(lz->cctx, io->next_out, io->avail_out, NULL);
+
+    if (LZ4F_isError(rc)) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "[gunzreq] LZ4F_compressEnd() failed: %s",
+                      LZ4F_getErrorName(rc));
+        return NGX_ERROR;
+    }
+
+    io->next_out += rc;
+    io->avail_out -= rc;
+
+    lz->begun = 0;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gunzip_request_lz4_destroy(void *data)
+{
+    ngx_http_gunzip_request_lz4_t *lz = data;
+
+    (void) LZ4F_freeCompressionContext(lz->cctx);
+    ngx_free(lz);
+}
+
+#endif
+
+
+#if (NGX_HTTP_GUNZIP_REQUEST_ISAL)
+
+static void *
+ngx_http_gunzip_request_isal_create(ngx_log_t *log)
+{
+    struct inflate_state  *st;
+
+    st = ngx_alloc(sizeof(struct inflate_state), log);
+    if (st == NULL) {
+        return NULL;
+    }
+
+    isal_inflate_init(st);
+    st->crc_flag = ISAL_GZIP;
+
+    return st;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_isal_reset(void *data, ngx_log_t *log)
+{
+    struct inflate_state  *st = data;
+
+    isal_inflate_reset(st);
+    st->crc_flag = ISAL_GZIP;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_isal_feed(void *data, ngx_http_gunzip_request_io_t *io,
+    ngx_uint_t flush, ngx_log_t *log)
+{
+    int                    rc;
+    struct inflate_state  *st = data;
+
+    /* isal_inflate() always flushes as much output as it can */
+
+    st->next_in = io->next_in;
+    st->avail_in = io->avail_in;
+    st->next_out = io->next_out;
+    st->avail_out = io->avail_out;
+
+    rc = isal_inflate(st);
+
+    io->next_in = st->next_in;
+    io->avail_in = st->avail_in;
+    io->next_out = st->next_out;
+    io->avail_out = st->avail_out;
+
+    if (rc != ISAL_DECOMP_OK && rc != ISAL_END_INPUT
+        && rc != ISAL_OUT_OVERFLOW)
+    {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "[gunzreq] isal_inflate() failed: %d", rc);
+        return NGX_ERROR;
+    }
+
+    if (st->block_state == ISAL_BLOCK_FINISH) {
+        return NGX_DONE;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gunzip_request_isal_destroy(void *data)
+{
+    ngx_free(data);
+}
+
+#endif
+
+
+static ngx_http_gunzip_request_state_t *
+ngx_http_gunzip_request_state_get(ngx_http_gunzip_request_engine_t *engine,
+    ngx_log_t *log)
+{
+    ngx_queue_t                      *q;
+    ngx_http_gunzip_request_state_t  *st;
+
+    if (engine->nfree) {
+        q = ngx_queue_head(&engine->free);
+        ngx_queue_remove(q);
+        engine->nfree--;
+
+        st = ngx_queue_data(q, ngx_http_gunzip_request_state_t, queue);
+
+        if (engine->reset(st->data, log) == NGX_OK) {
+            ngx_http_gunzip_request_pool_hits++;
+            ngx_http_gunzip_request_stat(pool_hits, 1);
+
+            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, log, 0,
+                           "[gunzreq] pool hit: %V %p hits:%ui misses:%ui",
+                           &engine->name, st,
+                           ngx_http_gunzip_request_pool_hits,
+                           ngx_http_gunzip_request_pool_misses);
+
+            return st;
+        }
+
+        engine->destroy(st->data);
+        ngx_free(st);
+    }
+
+    ngx_http_gunzip_request_pool_misses++;
+    ngx_http_gunzip_request_stat(pool_misses, 1);
+
+    st = ngx_alloc(sizeof(ngx_http_gunzip_request_state_t), log);
+    if (st == NULL) {
+        return NULL;
+    }
+
+    st->engine = engine;
+
+    st->data = engine->create(log);
+    if (st->data == NULL) {
+        ngx_free(st);
+        return NULL;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "[gunzreq] pool miss: %V %p hits:%ui misses:%ui",
+                   &engine->name, st,
+                   ngx_http_gunzip_request_pool_hits,
+                   ngx_http_gunzip_request_pool_misses);
+
+    return st;
+}
+
+
+static void
+ngx_http_gunzip_request_state_put(ngx_http_gunzip_request_state_t *st)
+{
+    ngx_http_gunzip_request_engine_t  *engine;
+
+    engine = st->engine;
+
+    if (engine->reset && engine->nfree < ngx_http_gunzip_request_pool_size) {
+        if (engine->nfree == 0) {
+            ngx_queue_init(&engine->free);
+        }
+
+        ngx_queue_insert_head(&engine->free, &st->queue);
+        engine->nfree++;
+        return;
+    }
+
+    engine->destroy(st->data);
+    ngx_free(st);
+}
+
+
+static void
+ngx_http_gunzip_request_pool_destroy(ngx_http_gunzip_request_engine_t *engine)
+{
+    ngx_queue_t                      *q;
+    ngx_http_gunzip_request_state_t  *st;
+
+    while (engine->nfree) {
+        q = ngx_queue_head(&engine->free);
+        ngx_queue_remove(q);
+        engine->nfree--;
+
+        st = ngx_queue_data(q, ngx_http_gunzip_request_state_t, queue);
+
+        engine->destroy(st->data);
+        ngx_free(st);
+    }
+}
+
+
+static void
+ngx_http_gunzip_request_cleanup(void *data)
+{
+    ngx_http_gunzip_request_ctx_t *ctx = data;
+
+    if (ctx->state) {
+        ngx_http_gunzip_request_state_put(ctx->state);
+        ctx->state = NULL;
+    }
+}
+
+static ngx_int_t
+ngx_http_gunzip_request_inflate_start(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx)
+{
+    ngx_pool_cleanup_t                   *cln;
+    ngx_http_gunzip_request_conf_t       *conf;
+    ngx_http_gunzip_request_main_conf_t  *gmcf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] inflate start");
+
+    ctx->request = r;
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    gmcf = ngx_http_get_module_main_conf(r, ngx_http_gunzip_request_module);
+
+    ctx->state = ngx_http_gunzip_request_state_get(ctx->coding->engine
+                                                   ? ctx->coding->engine
+                                                   : gmcf->engine,
+                                                   r->connection->log);
+    if (ctx->state == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_gunzip_request_cleanup;
+    cln->data = ctx;
+
+    if (ctx->state->engine->dictionary
+        && ctx->state->engine->dictionary(ctx->state->data,
+                                      ngx_http_gunzip_request_dictionary_find(r),
+                                      r->connection->log)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
+
+    ctx->io.next_in = NULL;
+    ctx->io.avail_in = 0;
+    ctx->io.skip_crc = !conf->verify_crc;
+
+    ctx->started = 1;
+
+    ctx->last_out = &ctx->out;
+    ctx->flush = NGX_HTTP_GUNZIP_REQUEST_NO_FLUSH;
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_gunzip_request_inflate_end(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx)
+{
+    ngx_buf_t                       *b;
+    ngx_uint_t                       i, ratio;
+    ngx_chain_t                     *cl;
+    ngx_http_gunzip_request_conf_t  *conf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] gunzip inflate end");
+
+    /* give the stream back to the pool as early as possible */
+    ngx_http_gunzip_request_cleanup(ctx);
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
+
+    if (conf->adaptive && ctx->received > 0) {
+        ratio = (ngx_uint_t) ngx_min((off_t) ctx->sum * 16 / ctx->received,
+                                     NGX_HTTP_GUNZIP_REQUEST_RATIO_MAX);
+
+        ngx_http_gunzip_request_ratio =
+                              (ngx_http_gunzip_request_ratio * 7 + ratio) / 8;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "[gunzreq] ratio: %ui avg:%ui",
+                       ratio, ngx_http_gunzip_request_ratio);
+    }
+
+    ngx_http_gunzip_request_stat(in_bytes, ctx->received);
+    ngx_http_gunzip_request_stat(out_bytes, ctx->sum);
+    ngx_http_gunzip_request_stat(usec, ctx->usec);
+
+    for (i = 0; i < NGX_HTTP_GUNZIP_REQUEST_BUCKETS - 1; i++) {
+        if (ctx->usec <= ngx_http_gunzip_request_buckets[i]) {
+            break;
+        }
+    }
+
+    ngx_http_gunzip_request_stat(latency[i], 1);
+
+    b = ctx->out_buf;
+
+    if (ctx->cache_in && b && (size_t) ngx_buf_size(b) == ctx->sum) {
+        /* the whole body is in the last buffer */
+        ngx_http_gunzip_request_cache_store(r, ctx, b);
+    }
+
+    // update content_length_n
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] recv_sum=%d", ctx->sum);
+    r->headers_in.content_length_n = ctx->sum;
+
+    if (b == NULL || ngx_buf_size(b) == 0) {
+
+        b = ngx_calloc_buf(ctx->request->pool);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    cl->buf = b;
+    cl->next = NULL;
+    *ctx->last_out = cl;
+    ctx->last_out = &cl->next;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+    b->sync = 1;
+
+    ctx->done = 1;
+
+    return NGX_OK;
+}
+
+/*
+ * gunzip_request_input_batch: small memory buffers are copied into one
+ * staging buffer, and fed to the decoder when it is full, or on a flush or
+ * the last buffer; NGX_DECLINED means the staged data waits for more input
+ */
+
+static ngx_int_t
+ngx_http_gunzip_request_batch(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx, size_t size)
+{
+    size_t      n;
+    ngx_buf_t  *b, *in;
+
+    b = ctx->batch;
+
+    if (b == NULL) {
+        b = ngx_create_temp_buf(r->pool, size);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->tag = (ngx_buf_tag_t) &ngx_http_gunzip_request_module;
+        ctx->batch = b;
+    }
+
+    if (b->pos == b->last) {
+        b->pos = b->start;
+        b->last = b->start;
+
+        b->last_buf = 0;
+        b->last_in_chain = 0;
+        b->flush = 0;
+    }
+
+    while (ctx->in) {
+        in = ctx->in->buf;
+
+        /* file buffers are read as they are, after the staged data */
+
+        if (!ngx_buf_in_memory_only(in) && !ngx_buf_special(in)) {
+            break;
+        }
+
+        n = ngx_min((size_t) (in->last - in->pos),
+                    (size_t) (b->end - b->last));
+
+        if (n) {
+            b->last = ngx_cpymem(b->last, in->pos, n);
+            in->pos += n;
+        }
+
+        if (in->pos != in->last) {
+            /* the rest goes to the next batch */
+            break;
+        }
+
+        ctx->in = ctx->in->next;
+
+        if (in->last_buf || in->last_in_chain || in->flush) {
+            b->last_buf = in->last_buf;
+            b->last_in_chain = in->last_in_chain;
+            b->flush = in->flush;
+            break;
+        }
+
+        if (b->last == b->end) {
+            break;
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] batch: %uz, more:%d",
+                   (size_t) (b->last - b->pos), ctx->in != NULL);
+
+    if (ctx->in == NULL && b->last != b->end
+        && !b->last_buf && !b->last_in_chain && !b->flush)
+    {
+        return NGX_DECLINED;
+    }
+
+    ctx->in_buf = b;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_add_data(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx)
+{
+    ngx_int_t                        rc;
+    ngx_http_gunzip_request_conf_t  *conf;
+
+    if (ctx->io.avail_in || ctx->flush != NGX_HTTP_GUNZIP_REQUEST_NO_FLUSH || ctx->redo) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] in: %p (%d)", ctx->in, ctx->in != NULL ? ngx_buf_size(ctx->in->buf): -1);
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
+
+    if (conf->input_batch && !ngx_http_gunzip_request_file_left(ctx->in_buf)
+        && ((ctx->batch && ctx->batch->last != ctx->batch->pos)
+            || (ctx->in && ngx_buf_in_memory_only(ctx->in->buf)
+                && (size_t) ngx_buf_size(ctx->in->buf) < conf->input_batch)))
+    {
+        rc = ngx_http_gunzip_request_batch(r, ctx, conf->input_batch);
+        if (rc != NGX_OK) {
+            return rc;
+        }
+
+    } else if (!ngx_http_gunzip_request_file_left(ctx->in_buf)) {
+
+        if (ctx->in == NULL) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] add_data case#5");
+            return NGX_DECLINED;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "[gunzreq] in#2: size=%d next=%p", ngx_buf_size(ctx->in->buf), ctx->in->next);
+
+        ctx->in_buf = ctx->in->buf;
+        ctx->in = ctx->in->next;
+
+        if (ngx_http_gunzip_request_file_left(ctx->in_buf)) {
+            ctx->in_file = 1;
+
+            if (ngx_read_ahead(ctx->in_buf->file->fd,
+                               (size_t) (ctx->in_buf->file_last
+                                         - ctx->in_buf->file_pos))
+                == NGX_ERROR)
+            {
+                ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                              ngx_read_ahead_n " \"%V\" failed",
+                              &ctx->in_buf->file->name);
+            }
+        }
+    }
+
+    if (ngx_http_gunzip_request_file_left(ctx->in_buf)) {
+        if (ngx_http_gunzip_request_read_file(r, ctx) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+    } else {
+        ctx->io.next_in = ctx->in_buf->pos;
+        ctx->io.avail_in = ctx->in_buf->last - ctx->in_buf->pos;
+    }
+
+    ctx->received += ctx->io.avail_in;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] in_buf:%p ni:%p ai:%uz",
+                   ctx->in_buf,
+                   ctx->io.next_in, ctx->io.avail_in);
+
+    if (ngx_http_gunzip_request_file_left(ctx->in_buf)) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] add_data case#4");
+
+    } else if (ctx->in_buf->last_buf || ctx->in_buf->last_in_chain) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] add_data case#1");
+        ctx->flush = NGX_HTTP_GUNZIP_REQUEST_FINISH;
+
+    } else if (ctx->in_buf->flush) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] add_data case#2");
+        ctx->flush = NGX_HTTP_GUNZIP_REQUEST_SYNC_FLUSH;
+
+    } else if (ctx->io.avail_in == 0) {
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] add_data case#3");
         return NGX_AGAIN;
     } else {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] add_data case#0");
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] add_data case#0");
+    }
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_gunzip_request_read_file(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx)
+{
+    size_t                     size;
+    ssize_t                    n;
+    ngx_buf_t                 *b;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    b = ctx->in_buf;
+
+    /* read in chunks as large as nginx reads a body from a client */
+
+    if (ctx->file_buf == NULL) {
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        ctx->file_buf = ngx_create_temp_buf(r->pool,
+                                            clcf->client_body_buffer_size);
+        if (ctx->file_buf == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    size = (size_t) ngx_min((off_t) (ctx->file_buf->end - ctx->file_buf->start),
+                            b->file_last - b->file_pos);
+
+    n = ngx_read_file(b->file, ctx->file_buf->start, size, b->file_pos);
+
+    if (n == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if ((size_t) n != size) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      ngx_read_file_n " read only %z of %uz from \"%V\"",
+                      n, size, &b->file->name);
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] read file: %O +%z", b->file_pos, n);
+
+    b->file_pos += n;
+
+    ctx->io.next_in = ctx->file_buf->start;
+    ctx->io.avail_in = n;
+
+    return NGX_OK;
+}
+
+static size_t
+ngx_http_gunzip_request_adaptive_size(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx, ngx_http_gunzip_request_conf_t *conf)
+{
+    off_t   size;
+    size_t  room;
+
+    /*
+     * the first buffer is sized to the expected body, the next ones
+     * double, both are limited by the buffers left
+     */
+
+    room = (conf->bufs.num - ctx->bufs) * conf->bufs.size;
+
+    if (ctx->buf_size) {
+        size = (off_t) ctx->buf_size * 2;
+
+    } else if (r->headers_in.content_length_n > 0) {
+        size = r->headers_in.content_length_n * ngx_http_gunzip_request_ratio
+               / 16;
+
+    } else {
+        size = conf->bufs.size;
+    }
+
+    size = ngx_min(size, (off_t) room);
+
+    /* whole pages, as ctx->bufs counts them */
+    size = (size + conf->bufs.size - 1) / conf->bufs.size * conf->bufs.size;
+
+    if (size < (off_t) conf->bufs.size) {
+        size = conf->bufs.size;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] adaptive buffer: %O ratio:%ui",
+                   size, ngx_http_gunzip_request_ratio);
+
+    return (size_t) size;
+}
+
+
+static void
+ngx_http_gunzip_request_release(ngx_http_gunzip_request_ctx_t *ctx,
+    size_t size)
+{
+    ctx->mem -= size;
+
+    ngx_http_gunzip_request_memory -= size;
+    ngx_http_gunzip_request_stat(memory, - (ngx_atomic_int_t) size);
+}
+
+
+static void
+ngx_http_gunzip_request_memory_cleanup(void *data)
+{
+    ngx_http_gunzip_request_ctx_t *ctx = data;
+
+    ngx_http_gunzip_request_release(ctx, ctx->mem);
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_charge(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx, size_t size)
+{
+    ngx_pool_cleanup_t  *cln;
+
+    if (ngx_http_gunzip_request_memory_limit
+        && ngx_http_gunzip_request_memory + size
+           > ngx_http_gunzip_request_memory_limit)
+    {
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "[gunzreq] memory limit: %uz + %uz > %uz",
+                       ngx_http_gunzip_request_memory, size,
+                       ngx_http_gunzip_request_memory_limit);
+
+        ctx->overbudget = 1;
+        return NGX_DECLINED;
+    }
+
+    if (ctx->mem == 0) {
+        /* buffers are freed with the request pool */
+
+        cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_http_gunzip_request_memory_cleanup;
+        cln->data = ctx;
+    }
+
+    ctx->overbudget = 0;
+    ctx->mem += size;
+
+    ngx_http_gunzip_request_memory += size;
+    ngx_http_gunzip_request_stat(memory, size);
+
+    return NGX_OK;
+}
+
+
+/*
+ * gunzip_request_single_buffer: the full output buffer is replaced with
+ * one twice as large while that still leaves pages of
+ * gunzip_request_buffers free; NGX_DECLINED means the rest of the body
+ * goes on in those pages
+ */
+
+static ngx_int_t
+ngx_http_gunzip_request_grow(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx, ngx_http_gunzip_request_conf_t *conf)
+{
+    size_t      size, room;
+    ngx_int_t   rc, pages, n;
+    ngx_buf_t  *b, *nb;
+
+    b = ctx->out_buf;
+
+    size = b->end - b->start;
+    pages = (size + conf->bufs.size - 1) / conf->bufs.size;
+
+    /* the pages of the old buffer are given back */
+    n = conf->bufs.num - ctx->bufs + pages;
+
+    room = n > 0 ? (size_t) n * conf->bufs.size : 0;
+
+    if (size * 2 >= room) {
+        return NGX_DECLINED;
+    }
+
+    size *= 2;
+
+    rc = ngx_http_gunzip_request_charge(r, ctx, size);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] grow: %uz to %uz", b->end - b->start, size);
+
+    nb = ngx_create_temp_buf(r->pool, size);
+    if (nb == NULL) {
+        return NGX_ERROR;
+    }
+
+    nb->last = ngx_cpymem(nb->pos, b->pos, b->last - b->pos);
+
+    nb->tag = (ngx_buf_tag_t) &ngx_http_gunzip_request_module;
+    nb->recycled = 1;
+
+    ngx_http_gunzip_request_release(ctx, b->end - b->start);
+    (void) ngx_pfree(r->pool, b->start);
+
+    ctx->bufs += (ngx_int_t) ((size + conf->bufs.size - 1) / conf->bufs.size)
+                 - pages;
+    ctx->buf_size = size;
+    ctx->out_buf = nb;
+
+    ctx->io.next_out = nb->last;
+    ctx->io.avail_out = nb->end - nb->last;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_get_buf(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx)
+{
+    size_t                           size;
+    ngx_int_t                        rc;
+    ngx_chain_t                     *cl;
+    ngx_http_gunzip_request_conf_t  *conf;
+
+    if (ctx->io.avail_out) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] get_buf: case#0");
+        return NGX_OK;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
+
+    if (ctx->single && ctx->out_buf) {
+        rc = ngx_http_gunzip_request_grow(r, ctx, conf);
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+
+        /*
+         * the buffer is passed on with the next output, and the rest of
+         * the body goes to the pages left as usual
+         */
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = ctx->out_buf;
+        cl->next = NULL;
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+
+        ctx->single = 0;
+        ctx->out_buf = NULL;
+    }
+
+    if (ctx->free) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] get_buf: case#1");
+        ctx->out_buf = ctx->free->buf;
+        ctx->free = ctx->free->next;
+
+        ctx->out_buf->flush = 0;
+
+    } else if (ctx->bufs < conf->bufs.num) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] get_buf: case#2");
+
+        size = conf->bufs.size;
+
+        if (ctx->size_hint) {
+            size = ctx->size_hint;
+
+        } else if (conf->adaptive || ctx->single) {
+            size = ngx_http_gunzip_request_adaptive_size(r, ctx, conf);
+        }
+
+        if (ctx->single && ctx->size_hint == 0) {
+            /* an estimate leaves half of the pages for the rest */
+            size = ngx_min(size, (conf->bufs.num - ctx->bufs) / 2
+                                 * conf->bufs.size);
+            size = ngx_max(size, conf->bufs.size);
+        }
+
+        rc = ngx_http_gunzip_request_charge(r, ctx, size);
+
+        if (rc == NGX_DECLINED && size > conf->bufs.size) {
+            /* a smaller buffer may still fit */
+            size = conf->bufs.size;
+            rc = ngx_http_gunzip_request_charge(r, ctx, size);
+        }
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (rc == NGX_DECLINED) {
+
+            /*
+             * over the budget of the worker, the request spills or waits
+             * with buffers it already has, see the body filter
+             */
+
+            if ((ctx->in_file || conf->temp_path) && ctx->bufs) {
+                ctx->spill = 1;
+            }
+
+            ctx->nomem = 1;
+            return NGX_DECLINED;
+        }
+
+        ctx->size_hint = 0;
+        ctx->buf_size = size;
+
+        ctx->out_buf = ngx_create_temp_buf(r->pool, size);
+        if (ctx->out_buf == NULL) {
+            return NGX_ERROR;
+        }
+
+        ctx->out_buf->tag = (ngx_buf_tag_t) &ngx_http_gunzip_request_module;
+        ctx->out_buf->recycled = 1;
+
+        /* a large buffer counts as many as it could hold */
+        ctx->bufs += (size + conf->bufs.size - 1) / conf->bufs.size;
+
+        /*
+         * with gunzip_request_temp_path, or for a body read from a file,
+         * the buffers are written to a temporary file and reused once they
+         * run out
+         */
+
+        if ((ctx->in_file || conf->temp_path) && ctx->bufs >= conf->bufs.num
+            && !ctx->single)
+        {
+            ctx->spill = 1;
+        }
+
+    } else {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] get_buf: case#3");
+        ngx_http_gunzip_request_stat(nomem, 1);
+        ctx->nomem = 1;
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] get_buf: case#4");
+    ctx->io.next_out = ctx->out_buf->pos;
+    ctx->io.avail_out = ctx->out_buf->end - ctx->out_buf->pos;
+
+    return NGX_OK;
+}
+
+static ngx_uint_t
+ngx_http_gunzip_request_elapsed(struct timeval *start)
+{
+    ngx_int_t       usec;
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    usec = (tv.tv_sec - start->tv_sec) * 1000000
+           + (tv.tv_usec - start->tv_usec);
+
+    return usec > 0 ? (ngx_uint_t) usec : 0;
+}
+
+
+static ngx_uint_t
+ngx_http_gunzip_request_ratio_exceeded(ngx_uint_t max_ratio, size_t out,
+    off_t in, ngx_log_t *log)
+{
+    if (max_ratio == 0 || out <= NGX_HTTP_GUNZIP_REQUEST_RATIO_SLACK) {
+        return 0;
+    }
+
+    if (in > 0 && (off_t) out / in < (off_t) max_ratio) {
+        return 0;
+    }
+
+    ngx_log_error(NGX_LOG_WARN, log, 0,
+                  "[gunzreq] inflated %uz bytes from %O, "
+                  "ratio exceeds %ui", out, in, max_ratio);
+
+    ngx_http_gunzip_request_stat(bombs, 1);
+
+    return 1;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_inflate(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx)
+{
+    ngx_int_t     rc;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+    size_t        curr;
+    struct timeval  tv;
+    ngx_http_gunzip_request_conf_t *conf;
+
+    curr = ctx->io.avail_out;
+    ngx_log_debug6(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] inflate in: ni:%p no:%p ai:%uz ao:%uz fl:%d redo:%d",
+                   ctx->io.next_in, ctx->io.next_out,
+                   ctx->io.avail_in, ctx->io.avail_out,
+                   ctx->flush, ctx->redo);
+
+    ngx_gettimeofday(&tv);
+
+    rc = ctx->state->engine->feed(ctx->state->data, &ctx->io, ctx->flush,
+                                  r->connection->log);
+
+    ctx->usec += ngx_http_gunzip_request_elapsed(&tv);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (curr > ctx->io.avail_out) {
+        ctx->sum += curr - ctx->io.avail_out;
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "[gunzreq] inflate and update sum: %d", ctx->sum);
+
+        // check overflow of inflate size against zip bomb
+        conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
+        if (conf->max_inflate_size > 0 && ctx->sum > conf->max_inflate_size) {
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                    "[gunzreq] overflow max inflate size: %d > %d", ctx->sum, conf->max_inflate_size);
+            return NGX_DECLINED;
+        }
+
+        if (ngx_http_gunzip_request_ratio_exceeded(conf->max_ratio, ctx->sum,
+                                       ctx->received - (off_t) ctx->io.avail_in,
+                                       r->connection->log))
+        {
+            return NGX_DECLINED;
+        }
+    }
+    ngx_log_debug5(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] inflate out: ni:%p no:%p ai:%uz ao:%uz rc:%i",
+                   ctx->io.next_in, ctx->io.next_out,
+                   ctx->io.avail_in, ctx->io.avail_out,
+                   rc);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] gunzip in_buf:%p pos:%p",
+                   ctx->in_buf, ctx->in_buf->pos);
+
+    if (ctx->io.next_in) {
+        if (ngx_buf_in_memory(ctx->in_buf)) {
+            ctx->in_buf->pos = ctx->io.next_in;
+        }
+
+        if (ctx->io.avail_in == 0) {
+            ctx->io.next_in = NULL;
+        }
+    }
+
+    ctx->out_buf->last = ctx->io.next_out;
+
+    if (ctx->io.avail_out == 0) {
+
+        /* zlib wants to output some more data */
+
+        if (ctx->single) {
+            /* get_buf() grows the buffer */
+            ctx->redo = 1;
+            return NGX_AGAIN;
+        }
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = ctx->out_buf;
+        cl->next = NULL;
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+
+        ctx->redo = 1;
+
+        return NGX_AGAIN;
+    }
+
+    ctx->redo = 0;
+
+    if (ctx->flush == NGX_HTTP_GUNZIP_REQUEST_SYNC_FLUSH) {
+
+        ctx->flush = NGX_HTTP_GUNZIP_REQUEST_NO_FLUSH;
+
+        if (ctx->single) {
+            return NGX_OK;
+        }
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        b = ctx->out_buf;
+
+        if (ngx_buf_size(b) == 0) {
+
+            b = ngx_calloc_buf(ctx->request->pool);
+            if (b == NULL) {
+                return NGX_ERROR;
+            }
+
+        } else {
+            ctx->io.avail_out = 0;
+        }
+
+        b->flush = 1;
+
+        cl->buf = b;
+        cl->next = NULL;
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+
+        return NGX_OK;
+    }
+
+    if (ctx->flush == NGX_HTTP_GUNZIP_REQUEST_FINISH && ctx->io.avail_in == 0) {
+
+        if (rc != NGX_DONE) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "[gunzreq] inflate() returned %i on response end", rc);
+            return NGX_ERROR;
+        }
+
+        if (ngx_http_gunzip_request_inflate_end(r, ctx) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+    if (rc == NGX_DONE && ctx->io.avail_in > 0) {
+
+        if (ctx->state->engine->reset == NULL) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "[gunzreq] extra data after %V stream",
+                          &ctx->state->engine->name);
+            return NGX_ERROR;
+        }
+
+        if (ctx->state->engine->reset(ctx->state->data, r->connection->log)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        ctx->redo = 1;
+
+        return NGX_AGAIN;
+    }
+
+    if (ngx_http_gunzip_request_file_left(ctx->in_buf)) {
+        return NGX_AGAIN;
+    }
+
+    if (ctx->in == NULL) {
+
+        b = ctx->out_buf;
+
+        /*
+         * partial buffers are not worth a write to a temporary file, and
+         * a single buffer is passed when the body ends
+         */
+
+        if (ngx_buf_size(b) == 0 || ctx->spill || ctx->single) {
+            return NGX_OK;
+        }
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        ctx->io.avail_out = 0;
+
+        cl->buf = b;
+        cl->next = NULL;
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+
+        return NGX_OK;
+    }
+
+    return NGX_AGAIN;
+}
+
+static ngx_temp_file_t *
+ngx_http_gunzip_request_temp_file(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx)
+{
+    ngx_temp_file_t                 *tf;
+    ngx_http_core_loc_conf_t        *clcf;
+    ngx_http_gunzip_request_conf_t  *conf;
+
+    if (ctx->temp_file) {
+        return ctx->temp_file;
+    }
+
+    tf = ngx_pcalloc(r->pool, sizeof(ngx_temp_file_t));
+    if (tf == NULL) {
+        return NULL;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    tf->file.fd = NGX_INVALID_FILE;
+    tf->file.log = r->connection->log;
+    tf->path = conf->temp_path ? conf->temp_path : clcf->client_body_temp_path;
+    tf->pool = r->pool;
+    tf->warn = "an inflated request body is buffered to a temporary file";
+    tf->log_level = r->request_body_file_log_level;
+    tf->persistent = r->request_body_in_persistent_file;
+    tf->clean = r->request_body_in_clean_file;
+
+    if (r->request_body_file_group_access) {
+        tf->access = 0660;
+    }
+
+    ctx->temp_file = tf;
+
+    return tf;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_spill(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx, ngx_chain_t **out)
+{
+    off_t             offset;
+    ngx_buf_t        *b;
+    ngx_chain_t      *cl, *ln;
+    ngx_temp_file_t  *tf;
+
+    tf = ngx_http_gunzip_request_temp_file(r, ctx);
+    if (tf == NULL) {
+        return NGX_ERROR;
+    }
+
+    offset = tf->offset;
+
+    if (ngx_write_chain_to_temp_file(tf, ctx->out) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] spill: %O +%O", offset, tf->offset - offset);
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (tf->offset > offset) {
+        b->in_file = 1;
+        b->file = &tf->file;
+        b->file_pos = offset;
+        b->file_last = tf->offset;
+    }
+
+    /* the written buffers are free to be filled again */
+
+    for (cl = ctx->out; cl; cl = ln) {
+        ln = cl->next;
+
+        if (cl->buf->last_buf) {
+            b->last_buf = 1;
+        }
+
+        if (cl->buf->last_in_chain) {
+            b->last_in_chain = 1;
+        }
+
+        if (cl->buf->flush) {
+            b->flush = 1;
+        }
+
+        if (cl->buf->sync) {
+            b->sync = 1;
+        }
+
+        if (cl->buf->tag != (ngx_buf_tag_t) &ngx_http_gunzip_request_module) {
+            ngx_free_chain(r->pool, cl);
+            continue;
+        }
+
+        cl->buf->pos = cl->buf->start;
+        cl->buf->last = cl->buf->start;
+
+        cl->next = ctx->free;
+        ctx->free = cl;
+    }
+
+    ctx->out = NULL;
+    ctx->last_out = &ctx->out;
+
+    if (!b->in_file && !ngx_buf_special(b)) {
+        *out = NULL;
+        return NGX_OK;
+    }
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    *out = cl;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_gunzip_request_coding_t *
+ngx_http_gunzip_request_find_coding(ngx_str_t *value, ngx_uint_t mask)
+{
+    ngx_http_gunzip_request_coding_t  *coding;
+
+    for (coding = ngx_http_gunzip_request_codings; coding->name.len; coding++) {
+
+        if ((coding->mask & mask)
+            && coding->name.len == value->len
+            && ngx_strncasecmp(coding->name.data, value->data, value->len)
+               == 0)
+        {
+            return coding;
+        }
+    }
+
+    return NULL;
+}
+
+
+static size_t
+ngx_http_gunzip_request_isize(ngx_buf_t *b)
+{
+    u_char  *p;
+
+    /* ISIZE, the last 4 bytes of gzip trailer, little endian */
+
+    p = b->last - 4;
+
+    return (size_t) p[0]
+           | (size_t) p[1] << 8
+           | (size_t) p[2] << 16
+           | (size_t) p[3] << 24;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_check_isize(ngx_http_request_t *r, ngx_buf_t *b)
+{
+    size_t                           isize, size;
+    ngx_http_gunzip_request_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
+
+    if (conf->max_inflate_size == 0 && conf->max_ratio == 0) {
+        return NGX_OK;
+    }
+
+    /*
+     * a whole gzip body inflates at least to ISIZE of its last member,
+     * so rejecting by it never refuses a body the limits would accept
+     */
+
+    size = b->last - b->pos;
+
+    if (size < 18) {
+        return NGX_OK;
+    }
+
+    isize = ngx_http_gunzip_request_isize(b);
+
+    if (conf->max_inflate_size > 0 && isize > conf->max_inflate_size) {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "[gunzreq] ISIZE %uz exceeds max inflate size %uz",
+                      isize, conf->max_inflate_size);
+        ngx_http_gunzip_request_stat(bombs, 1);
+        return NGX_DECLINED;
+    }
+
+    if (ngx_http_gunzip_request_ratio_exceeded(conf->max_ratio, isize,
+                                               (off_t) size,
+                                               r->connection->log))
+    {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_whole_body(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx, ngx_chain_t *in)
+{
+    size_t                           isize, limit, size;
+    ngx_buf_t                       *b;
+    ngx_http_gunzip_request_conf_t  *conf;
+#if (NGX_HTTP_GUNZIP_REQUEST_LIBDEFLATE)
+    ngx_int_t                        rc;
+    size_t                           in_size, out_size;
+    struct timeval                   tv;
+    enum libdeflate_result           res;
+#endif
+
+    b = in->buf;
+
+    /* whole body in one memory buffer, and at least one gzip member */
+
+    if (in->next || !b->last_buf || !ngx_buf_in_memory_only(b)
+        || b->last - b->pos < 18)
+    {
+        return NGX_DECLINED;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
+
+    limit = conf->bufs.num * conf->bufs.size;
+
+    if (conf->max_inflate_size) {
+        limit = ngx_min(limit, conf->max_inflate_size);
+    }
+
+    isize = ngx_http_gunzip_request_isize(b);
+
+    /*
+     * ISIZE comes from the client, the buffer is not larger than the
+     * compressed body can inflate to
+     */
+
+    size = b->last - b->pos;
+
+    if (isize / NGX_HTTP_GUNZIP_REQUEST_DEFLATE_MAX >= size) {
+        isize = size * NGX_HTTP_GUNZIP_REQUEST_DEFLATE_MAX;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] whole body: isize:%uz limit:%uz", isize, limit);
+
+    if (isize == 0 || isize > limit) {
+        return NGX_DECLINED;
+    }
+
+#if (NGX_HTTP_GUNZIP_REQUEST_LIBDEFLATE)
+
+    if (ngx_http_gunzip_request_libdeflate == NULL) {
+        ngx_http_gunzip_request_libdeflate = libdeflate_alloc_decompressor();
+        if (ngx_http_gunzip_request_libdeflate == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    rc = ngx_http_gunzip_request_charge(r, ctx, isize);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    ctx->out_buf = ngx_create_temp_buf(r->pool, isize);
+    if (ctx->out_buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_gettimeofday(&tv);
+
+    res = libdeflate_gzip_decompress_ex(ngx_http_gunzip_request_libdeflate,
+                                        b->pos, b->last - b->pos,
+                                        ctx->out_buf->pos, isize,
+                                        &in_size, &out_size);
+
+    ctx->usec += ngx_http_gunzip_request_elapsed(&tv);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] libdeflate: rc:%d in:%uz out:%uz",
+                   res, in_size, out_size);
+
+    /*
+     * a truncated ISIZE or several members are left to the streaming
+     * engine, it starts over from the same input
+     */
+
+    if (res == LIBDEFLATE_SUCCESS && in_size == (size_t) (b->last - b->pos)) {
+        b->pos = b->last;
+
+        ctx->out_buf->last += out_size;
+        ctx->sum = out_size;
+        ctx->received = in_size;
+
+        ctx->request = r;
+        ctx->started = 1;
+        ctx->last_out = &ctx->out;
+
+        return ngx_http_gunzip_request_inflate_end(r, ctx);
+    }
+
+    (void) ngx_pfree(r->pool, ctx->out_buf->start);
+    ctx->out_buf = NULL;
+
+    ngx_http_gunzip_request_release(ctx, isize);
+
+#endif
+
+    /*
+     * one spare byte lets the stream end without asking for more room,
+     * and the buffer takes no more than the pages left
+     */
+
+    if (conf->bufs.num > ctx->bufs) {
+        limit = (conf->bufs.num - ctx->bufs) * conf->bufs.size;
+        ctx->size_hint = ngx_min(isize + 1, limit);
+    }
+
+    return NGX_DECLINED;
+}
+
+
+#if (NGX_HTTP_GUNZIP_REQUEST_THREADS)
+
+static ngx_int_t
+ngx_http_gunzip_request_thread_body(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx, ngx_chain_t *in)
+{
+    size_t                           size;
+    ssize_t                          n;
+    ngx_int_t                        rc;
+    ngx_buf_t                       *b;
+    ngx_uint_t                       last;
+    ngx_chain_t                     *cl;
+    ngx_http_gunzip_request_conf_t  *conf;
+
+    if (ctx->task || ctx->parallel) {
+        /* the whole body is already being inflated */
+        return NGX_OK;
+    }
+
+    /*
+     * the body is copied, so nginx can reuse its buffers while we are
+     * collecting the rest of it
+     */
+
+    if (ctx->thread_in == NULL) {
+        ctx->thread_in = ngx_create_temp_buf(r->pool,
+                                      (size_t) r->headers_in.content_length_n);
+        if (ctx->thread_in == NULL) {
+            return NGX_ERROR;
+        }
+
+        r->request_body->filter_need_buffering = 1;
+    }
+
+    last = 0;
+
+    for (cl = in; cl; cl = cl->next) {
+        b = cl->buf;
+
+        size = ngx_buf_size(b);
+
+        if (size > (size_t) (ctx->thread_in->end - ctx->thread_in->last)) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "[gunzreq] request body exceeds content length");
+            return NGX_ERROR;
+        }
+
+        if (ngx_http_gunzip_request_file_left(b)) {
+            n = ngx_read_file(b->file, ctx->thread_in->last, size,
+                              b->file_pos);
+
+            if (n == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            if ((size_t) n != size) {
+                ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                              ngx_read_file_n " read only %z of %uz from \"%V\"",
+                              n, size, &b->file->name);
+                return NGX_ERROR;
+            }
+
+            ctx->thread_in->last += n;
+            b->file_pos = b->file_last;
+
+        } else if (ngx_buf_in_memory(b)) {
+            ctx->thread_in->last = ngx_cpymem(ctx->thread_in->last, b->pos,
+                                              size);
+            b->pos = b->last;
+        }
+
+        if (b->last_buf) {
+            last = 1;
+        }
+    }
+
+    if (!last) {
+        return NGX_OK;
+    }
+
+    if (ctx->coding->mask == NGX_HTTP_GUNZIP_REQUEST_CODING_GZIP
+        && ngx_http_gunzip_request_check_isize(r, ctx->thread_in) != NGX_OK)
+    {
+        return NGX_DECLINED;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
+
+    if (conf->thread_parallel > 1
+        && ctx->coding->mask == NGX_HTTP_GUNZIP_REQUEST_CODING_GZIP)
+    {
+        rc = ngx_http_gunzip_request_parallel(r, ctx);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+    }
+
+    return ngx_http_gunzip_request_thread_post(r, ctx);
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_thread_post(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx)
+{
+    size_t                                 isize, limit;
+    ngx_pool_cleanup_t                    *cln;
+    ngx_temp_file_t                       *tf;
+    ngx_thread_task_t                     *task;
+    ngx_http_gunzip_request_conf_t        *conf;
+    ngx_http_gunzip_request_thread_ctx_t  *t;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
+
+    task = ngx_thread_task_alloc(r->pool,
+                                 sizeof(ngx_http_gunzip_request_thread_ctx_t));
+    if (task == NULL) {
+        return NGX_ERROR;
+    }
+
+    t = task->ctx;
+
+    t->state = ctx->state;
+    t->in = ctx->thread_in->pos;
+    t->in_size = ctx->thread_in->last - ctx->thread_in->pos;
+
+    t->nbufs = conf->bufs.num;
+    t->bufs = ngx_pcalloc(r->pool, t->nbufs * sizeof(ngx_buf_t));
+    if (t->bufs == NULL) {
+        return NGX_ERROR;
+    }
+
+    t->size = conf->bufs.size;
+    t->max_inflate_size = conf->max_inflate_size;
+    t->max_ratio = conf->max_ratio;
+    t->skip_crc = !conf->verify_crc;
+
+    isize = 0;
+
+    if (ctx->coding->mask == NGX_HTTP_GUNZIP_REQUEST_CODING_GZIP
+        && t->in_size >= 18)
+    {
+        limit = conf->bufs.num * conf->bufs.size;
+
+        if (conf->max_inflate_size) {
+            limit = ngx_min(limit, conf->max_inflate_size);
+        }
+
+        isize = ngx_http_gunzip_request_isize(ctx->thread_in);
+
+        if (isize / NGX_HTTP_GUNZIP_REQUEST_DEFLATE_MAX >= t->in_size) {
+            isize = t->in_size * NGX_HTTP_GUNZIP_REQUEST_DEFLATE_MAX;
+        }
+
+        /* within the buffers, so the thread takes what inline path does */
+
+        if (isize && isize < limit) {
+            t->size_hint = ngx_min(isize + 1, t->nbufs * t->size);
+        }
+    }
+
+    /*
+     * the thread can't create files, it is done here unless the output
+     * is known to fit in the buffers
+     */
+
+    if (conf->temp_path
+        && (isize == 0 || isize >= conf->bufs.num * conf->bufs.size))
+    {
+        t->temp_file = ngx_http_gunzip_request_temp_file(r, ctx);
+        if (t->temp_file == NULL) {
+            return NGX_ERROR;
+        }
+
+        tf = t->temp_file;
+
+        if (ngx_create_temp_file(&tf->file, tf->path, tf->pool,
+                                 tf->persistent, tf->clean, tf->access)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_gunzip_request_thread_cleanup;
+    cln->data = t;
+
+    task->handler = ngx_http_gunzip_request_thread_handler;
+    task->event.data = r;
+    task->event.handler = ngx_http_gunzip_request_thread_event_handler;
+
+    if (ngx_thread_task_post(conf->thread_pool, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] thread task posted: in:%uz", t->in_size);
+
+    ctx->task = task;
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gunzip_request_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_gunzip_request_thread_ctx_t *t = data;
+
+    size_t                             size, curr, total;
+    u_char                            *p;
+    ngx_int_t                          rc;
+    ngx_buf_t                         *b;
+    ngx_uint_t                         n, pages;
+    struct timeval                     tv;
+    ngx_http_gunzip_request_io_t       io;
+    ngx_http_gunzip_request_engine_t  *engine;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0, "[gunzreq] thread inflate");
+
+    engine = t->state->engine;
+
+    io.next_in = t->in;
+    io.avail_in = t->in_size;
+    io.next_out = NULL;
+    io.avail_out = 0;
+    io.skip_crc = t->skip_crc;
+
+    b = NULL;
+    pages = 0;
+
+    for ( ;; ) {
+
+        if (io.avail_out == 0) {
+
+            size = t->size;
+
+            if (t->size_hint) {
+                size = ngx_min(t->size_hint, t->nbufs * t->size);
+                t->size_hint = 0;
+            }
+
+            /* the same accounting as ngx_http_gunzip_request_get_buf() */
+
+            n = (size + t->size - 1) / t->size;
+
+            pages = t->pages ? ngx_atomic_fetch_add(t->pages, n) + n
+                             : pages + n;
+
+            if (pages > t->nbufs) {
+
+                if (t->temp_file == NULL) {
+                    t->rc = NGX_DECLINED;
+                    return;
+                }
+
+                if (ngx_http_gunzip_request_thread_spill(t) != NGX_OK) {
+                    t->rc = NGX_ERROR;
+                    return;
+                }
+
+                pages = (size + t->size - 1) / t->size;
+            }
+
+            p = ngx_alloc(size, log);
+            if (p == NULL) {
+                t->rc = NGX_ERROR;
+                return;
+            }
+
+            b = &t->bufs[t->nout++];
+
+            b->start = p;
+            b->pos = p;
+            b->last = p;
+            b->end = p + size;
+            b->temporary = 1;
+
+            io.next_out = p;
+            io.avail_out = size;
+        }
+
+        curr = io.avail_out;
+
+        ngx_gettimeofday(&tv);
+
+        rc = engine->feed(t->state->data, &io, NGX_HTTP_GUNZIP_REQUEST_FINISH,
+                          log);
+
+        t->usec += ngx_http_gunzip_request_elapsed(&tv);
+
+        if (rc == NGX_ERROR) {
+            t->rc = NGX_ERROR;
+            return;
+        }
+
+        b->last = io.next_out;
+        t->sum += curr - io.avail_out;
+
+        total = t->total ? ngx_atomic_fetch_add(t->total, curr - io.avail_out)
+                           + curr - io.avail_out
+                         : t->sum;
+
+        if (t->max_inflate_size > 0 && total > t->max_inflate_size) {
+            t->rc = NGX_DECLINED;
+            return;
+        }
+
+        if (ngx_http_gunzip_request_ratio_exceeded(t->max_ratio, t->sum,
+                                        (off_t) (t->in_size - io.avail_in),
+                                        log))
+        {
+            t->rc = NGX_DECLINED;
+            return;
+        }
+
+        if (rc == NGX_DONE) {
+
+            if (io.avail_in == 0) {
+                t->rc = NGX_OK;
+                return;
+            }
+
+            if (engine->reset == NULL) {
+                ngx_log_error(NGX_LOG_ERR, log, 0,
+                              "[gunzreq] extra data after %V stream",
+                              &engine->name);
+                t->rc = NGX_ERROR;
+                return;
+            }
+
+            if (engine->reset(t->state->data, log) != NGX_OK) {
+                t->rc = NGX_ERROR;
+                return;
+            }
+
+            continue;
+        }
+
+        if (io.avail_out && (io.avail_in == 0 || curr == io.avail_out)) {
+            ngx_log_error(NGX_LOG_ERR, log, 0,
+                          "[gunzreq] inflate() returned %i on response end",
+                          rc);
+            t->rc = NGX_ERROR;
+            return;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_thread_spill(ngx_http_gunzip_request_thread_ctx_t *t)
+{
+    ssize_t      n;
+    ngx_buf_t   *b;
+    ngx_uint_t   i;
+
+    for (i = 0; i < t->nout; i++) {
+        b = &t->bufs[i];
+
+        n = ngx_write_file(&t->temp_file->file, b->pos, b->last - b->pos,
+                           t->temp_file->offset);
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        t->temp_file->offset += n;
+
+        ngx_free(b->start);
+    }
+
+    t->nout = 0;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gunzip_request_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_int_t                       rc;
+    ngx_connection_t               *c;
+    ngx_http_request_t             *r;
+    ngx_http_gunzip_request_ctx_t  *ctx;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "[gunzreq] thread task done");
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    if (c->error) {
+        /* the request was terminated while inflating */
+        r->write_event_handler(r);
+        ngx_http_run_posted_requests(c);
+        return;
+    }
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_gunzip_request_module);
+
+    rc = ngx_http_gunzip_request_thread_output(r, ctx);
+
+    if (rc == NGX_DECLINED) {
+        ngx_http_gunzip_request_stat(rejected, 1);
+        (void) ngx_http_discard_request_body(r);
+        ngx_http_finalize_request(r, NGX_HTTP_REQUEST_ENTITY_TOO_LARGE);
+
+    } else if (rc == NGX_ERROR) {
+        ngx_http_gunzip_request_stat(errors, 1);
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+
+    } else {
+        /* let nginx notice that the body has been saved */
+        r->read_event_handler(r);
+    }
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_thread_output(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx)
+{
+    ngx_buf_t                             *b;
+    ngx_uint_t                             i;
+    ngx_chain_t                           *cl;
+    ngx_http_gunzip_request_thread_ctx_t  *t;
+
+    t = ctx->task->ctx;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] thread result: rc:%i bufs:%ui sum:%uz",
+                   t->rc, t->nout, t->sum);
+
+    ctx->done = 1;
+
+    if (t->rc != NGX_OK) {
+        ngx_http_gunzip_request_cleanup(ctx);
+        return t->rc;
+    }
+
+    if (t->temp_file && t->temp_file->offset) {
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->in_file = 1;
+        b->file = &t->temp_file->file;
+        b->file_pos = 0;
+        b->file_last = t->temp_file->offset;
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = b;
+        cl->next = NULL;
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+    }
+
+    for (i = 0; i + 1 < t->nout; i++) {
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = &t->bufs[i];
+        cl->next = NULL;
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+    }
+
+    ctx->out_buf = t->nout ? &t->bufs[t->nout - 1] : NULL;
+    ctx->sum = t->sum;
+    ctx->received = t->in_size;
+    ctx->usec = t->usec;
+
+    if (ngx_http_gunzip_request_inflate_end(r, ctx) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    cl = ctx->out;
+    ctx->out = NULL;
+    ctx->last_out = &ctx->out;
+
+    if (ngx_http_next_request_body_filter(r, cl) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gunzip_request_thread_cleanup(void *data)
+{
+    ngx_http_gunzip_request_thread_ctx_t *t = data;
+
+    ngx_uint_t  i;
+
+    for (i = 0; i < t->nout; i++) {
+        ngx_free(t->bufs[i].start);
+    }
+}
+
+
+/* a gzip member header as written by gzip and pigz, p has 18 bytes or more */
+#define ngx_http_gunzip_request_member(p)                                     \
+    ((p)[0] == 0x1f && (p)[1] == 0x8b && (p)[2] == 8                          \
+     && ((p)[3] & 0xe0) == 0                                                  \
+     && ((p)[8] == 0 || (p)[8] == 2 || (p)[8] == 4)                           \
+     && ((p)[9] <= 13 || (p)[9] == 255))
+
+
+static ngx_int_t
+ngx_http_gunzip_request_parallel(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx)
+{
+    u_char                                *p, *start, *end;
+    u_char                                *cuts[NGX_HTTP_GUNZIP_REQUEST_PARTS_MAX + 1];
+    size_t                                 size;
+    ngx_uint_t                             i, n, m;
+    ngx_pool_cleanup_t                    *cln;
+    ngx_thread_task_t                     *tasks[NGX_HTTP_GUNZIP_REQUEST_PARTS_MAX];
+    ngx_http_gunzip_request_conf_t        *conf;
+    ngx_http_gunzip_request_parallel_t    *pl;
+    ngx_http_gunzip_request_thread_ctx_t  *t;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
+
+    start = ctx->thread_in->pos;
+    end = ctx->thread_in->last;
+    size = end - start;
+
+    n = ngx_min(conf->thread_parallel, size / NGX_HTTP_GUNZIP_REQUEST_PART_MIN);
+
+    if (n < 2 || !ngx_http_gunzip_request_member(start)) {
+        return NGX_DECLINED;
+    }
+
+    /*
+     * cut at the first member header after each 1/n of the body; a false
+     * header inside of deflate data fails its part, see parallel_output()
+     */
+
+    cuts[0] = start;
+    m = 1;
+
+    for (i = 1; i < n; i++) {
+
+        p = ngx_max(start + size / n * i, cuts[m - 1] + 18);
+
+        while (p && p < end - 18) {
+
+            if (ngx_http_gunzip_request_member(p)) {
+                break;
+            }
+
+            p = ngx_strlchr(p + 1, end - 18, 0x1f);
+        }
+
+        if (p == NULL || p >= end - 18) {
+            break;
+        }
+
+        cuts[m++] = p;
+    }
+
+    if (m < 2) {
+        /* a single member */
+        return NGX_DECLINED;
+    }
+
+    cuts[m] = end;
+
+    pl = ngx_pcalloc(r->pool, sizeof(ngx_http_gunzip_request_parallel_t));
+    if (pl == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < m; i++) {
+        tasks[i] = ngx_thread_task_alloc(r->pool,
+                                  sizeof(ngx_http_gunzip_request_thread_ctx_t));
+        if (tasks[i] == NULL) {
+            return NGX_ERROR;
+        }
+
+        t = tasks[i]->ctx;
+
+        cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_http_gunzip_request_part_cleanup;
+        cln->data = t;
+
+        t->state = ngx_http_gunzip_request_state_get(ctx->state->engine,
+                                                     r->connection->log);
+        if (t->state == NULL) {
+            return NGX_ERROR;
+        }
+
+        t->in = cuts[i];
+        t->in_size = cuts[i + 1] - cuts[i];
+
+        t->nbufs = conf->bufs.num;
+        t->bufs = ngx_pcalloc(r->pool, t->nbufs * sizeof(ngx_buf_t));
+        if (t->bufs == NULL) {
+            return NGX_ERROR;
+        }
+
+        t->size = conf->bufs.size;
+        t->max_inflate_size = conf->max_inflate_size;
+        t->max_ratio = conf->max_ratio;
+        t->skip_crc = !conf->verify_crc;
+        t->pages = &pl->pages;
+        t->total = &pl->total;
+
+        tasks[i]->handler = ngx_http_gunzip_request_thread_handler;
+        tasks[i]->event.data = r;
+        tasks[i]->event.handler =
+                                ngx_http_gunzip_request_parallel_event_handler;
+
+        pl->parts[i] = t;
+    }
+
+    pl->nparts = m;
+
+    for (i = 0; i < m; i++) {
+        if (ngx_thread_task_post(conf->thread_pool, tasks[i]) != NGX_OK) {
+            /* parts already posted report to the event handler */
+            pl->failed = 1;
+            break;
+        }
+    }
+
+    if (i == 0) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] thread tasks posted: in:%uz parts:%ui",
+                   size, i);
+
+    ctx->parallel = pl;
+    pl->pending = i;
+
+    r->main->blocked += i;
+    r->aio = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gunzip_request_parallel_event_handler(ngx_event_t *ev)
+{
+    ngx_int_t                              rc;
+    ngx_uint_t                             i;
+    ngx_connection_t                      *c;
+    ngx_http_request_t                    *r;
+    ngx_http_gunzip_request_ctx_t         *ctx;
+    ngx_http_gunzip_request_parallel_t    *pl;
+    ngx_http_gunzip_request_thread_ctx_t  *t;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_gunzip_request_module);
+    pl = ctx->parallel;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "[gunzreq] thread part done, pending:%ui", pl->pending - 1);
+
+    r->main->blocked--;
+
+    if (--pl->pending) {
+        return;
+    }
+
+    r->aio = 0;
+
+    for (i = 0; i < pl->nparts; i++) {
+        t = pl->parts[i];
+
+        if (t->state) {
+            ngx_http_gunzip_request_state_put(t->state);
+            t->state = NULL;
+        }
+    }
+
+    if (c->error) {
+        /* the request was terminated while inflating */
+        r->write_event_handler(r);
+        ngx_http_run_posted_requests(c);
+        return;
+    }
+
+    rc = ngx_http_gunzip_request_parallel_output(r, ctx);
+
+    if (rc == NGX_DECLINED) {
+        /* inflate the body again in one task, it knows what went wrong */
+        rc = ngx_http_gunzip_request_thread_post(r, ctx);
+    }
+
+    if (rc == NGX_ERROR) {
+        ngx_http_gunzip_request_stat(errors, 1);
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+
+    } else if (ctx->task == NULL) {
+        /* let nginx notice that the body has been saved */
+        r->read_event_handler(r);
+    }
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_parallel_output(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx)
+{
+    ngx_buf_t                             *b;
+    ngx_uint_t                             i, j;
+    ngx_chain_t                           *cl;
+    ngx_http_gunzip_request_parallel_t    *pl;
+    ngx_http_gunzip_request_thread_ctx_t  *t;
+
+    pl = ctx->parallel;
+
+    for (i = 0; i < pl->nparts; i++) {
+        t = pl->parts[i];
+
+        ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "[gunzreq] thread part %ui: rc:%i bufs:%ui sum:%uz",
+                       i, t->rc, t->nout, t->sum);
+
+        if (pl->failed || t->rc != NGX_OK) {
+            goto failed;
+        }
+    }
+
+    ctx->done = 1;
+    ctx->received = ctx->thread_in->last - ctx->thread_in->pos;
+
+    b = NULL;
+
+    for (i = 0; i < pl->nparts; i++) {
+        t = pl->parts[i];
+
+        for (j = 0; j < t->nout; j++) {
+
+            if (t->bufs[j].last == t->bufs[j].pos) {
+                continue;
+            }
+
+            if (b) {
+                cl = ngx_alloc_chain_link(r->pool);
+                if (cl == NULL) {
+                    return NGX_ERROR;
+                }
+
+                cl->buf = b;
+                cl->next = NULL;
+                *ctx->last_out = cl;
+                ctx->last_out = &cl->next;
+            }
+
+            b = &t->bufs[j];
+        }
+
+        ctx->sum += t->sum;
+        ctx->usec += t->usec;
+    }
+
+    ctx->out_buf = b;
+
+    if (ngx_http_gunzip_request_inflate_end(r, ctx) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    cl = ctx->out;
+    ctx->out = NULL;
+    ctx->last_out = &ctx->out;
+
+    if (ngx_http_next_request_body_filter(r, cl) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    /*
+     * a false member header, a body too large for the buffers together,
+     * or a broken one: the parts are thrown away
+     */
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] thread parts failed, inflating in one task");
+
+    for (i = 0; i < pl->nparts; i++) {
+        ngx_http_gunzip_request_part_cleanup(pl->parts[i]);
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_http_gunzip_request_part_cleanup(void *data)
+{
+    ngx_http_gunzip_request_thread_ctx_t *t = data;
+
+    ngx_http_gunzip_request_thread_cleanup(t);
+    t->nout = 0;
+
+    if (t->state) {
+        ngx_http_gunzip_request_state_put(t->state);
+        t->state = NULL;
+    }
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_gunzip_request_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+{
+    ngx_http_gunzip_request_conf_t *conf;
+    ngx_http_gunzip_request_ctx_t  *ctx;
+    ngx_uint_t              flush, yield;
+    ngx_chain_t            *cl;
+    size_t                  sum;
+    int                     rc;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] filter invoked");
+
+    for (cl = in; cl; cl = cl->next) {
+        ngx_log_debug7(NGX_LOG_DEBUG_EVENT, r->connection->log, 0,
+                       "[gunzreq] new buf t:%d f:%d %p, pos %p, size: %z "
+                       "file: %O, size: %O",
+                       cl->buf->temporary, cl->buf->in_file,
+                       cl->buf->start, cl->buf->pos,
+                       cl->buf->last - cl->buf->pos,
+                       cl->buf->file_pos,
+                       cl->buf->file_last - cl->buf->file_pos);
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
+    if (!conf->enable) {
+        return ngx_http_next_request_body_filter(r, in);
+    }
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_gunzip_request_module);
+    if (ctx == NULL) {
+        /* the body is read before the precontent phase */
+        ctx = ngx_http_gunzip_request_detect(r, conf);
+        if (ctx == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (ctx->done || ctx->skip) {
+        return ngx_http_next_request_body_filter(r, in);
+    }
+
+    if (!ctx->checked) {
+        ctx->checked = 1;
+
+        if (conf->transcode && conf->transcode->mask == ctx->coding->mask) {
+            /* already in the coding to transcode to */
+            ctx->skip = 1;
+            return ngx_http_next_request_body_filter(r, in);
+        }
+
+        if (conf->transcode) {
+            if (ngx_http_gunzip_request_transcode_start(r, ctx) != NGX_OK) {
+                goto failed;
+            }
+
+            ctx->header->value = conf->transcode->engine.name;
+
+        } else {
+            ngx_str_set(&ctx->header->value, "identity");
+        }
+
+        ngx_http_gunzip_request_stat(requests, 1);
+
+        /*
+         * gunzip_request_stream: the length was dropped in the precontent
+         * phase, and is put back for a body which is buffered after all
+         */
+
+        if (ctx->stream && !r->request_body_no_buffering) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "[gunzreq] stream: restore content length %O",
+                           ctx->length);
+
+            ctx->stream = 0;
+
+            r->headers_in.content_length = ctx->content_length;
+            r->headers_in.content_length_n = ctx->length;
+            r->headers_in.chunked = 0;
+        }
+
+        /*
+         * a buffered body wanted in one piece, by $request_body or
+         * client_body_in_single_buffer for example, is inflated into one
+         * buffer which grows as needed
+         */
+
+        if ((conf->single_buffer || r->request_body_in_single_buf)
+            && !r->request_body_no_buffering && conf->transcode == NULL)
+        {
+            ctx->single = 1;
+        }
+
+        /*
+         * an unbuffered upstream request would be sent with the compressed
+         * Content-Length, so such a body is inflated whole before it is
+         * passed on, see also gunzip_request_stream
+         */
+
+        if (r->request_body_no_buffering
+            && r->headers_in.content_length_n >= 0)
+        {
+#if (NGX_HTTP_GUNZIP_REQUEST_NEED_BUFFERING)
+            r->request_body->filter_need_buffering = 1;
+#else
+            ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                          "[gunzreq] unbuffered body with Content-Length "
+                          "needs nginx 1.21.2 or later");
+#endif
+        }
+
+#if (NGX_HTTP_GUNZIP_REQUEST_NEED_BUFFERING)
+
+        /*
+         * a streamed body waits for upstream to take inflated buffers
+         * instead of failing when they run out: its input is left unread,
+         * so nginx holds back flow control credit of the HTTP/2 or HTTP/3
+         * stream (or stops reading the socket) until the filter is called
+         * again
+         */
+
+        if (r->request_body_no_buffering
+            && !r->request_body->filter_need_buffering)
+        {
+            ctx->backpressure = 1;
+        }
+
+#endif
+    }
+
+    if (ctx->stream) {
+        for (cl = in; cl; cl = cl->next) {
+            ctx->length -= ngx_buf_size(cl->buf);
+
+            if (ctx->length < 0 || (cl->buf->last_buf && ctx->length > 0)) {
+                goto bad_request;
+            }
+        }
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] decompress request body");
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                "[gunzreq] available ctx: busy=%d", ctx->busy != 0);
+
+#if (NGX_HTTP_GUNZIP_REQUEST_THREADS)
+
+    /*
+     * large bodies of known length are inflated in a thread at once; the
+     * compressed copy is held in memory, so it may not be larger than
+     * gunzip_request_buffers, and is charged to the memory budget
+     */
+
+    if (!ctx->started && conf->thread_pool
+        && r->http_version <= NGX_HTTP_VERSION_11
+        && r->headers_in.content_length_n >= (off_t) conf->thread_threshold
+        && r->headers_in.content_length_n > 0
+        && r->headers_in.content_length_n
+           <= (off_t) (conf->bufs.num * conf->bufs.size))
+    {
+        rc = ngx_http_gunzip_request_charge(r, ctx,
+                                      (size_t) r->headers_in.content_length_n);
+        if (rc == NGX_ERROR) {
+            goto failed;
+        }
+
+        if (rc == NGX_OK) {
+            if (ngx_http_gunzip_request_inflate_start(r, ctx) != NGX_OK) {
+                goto failed;
+            }
+
+            ctx->thread = 1;
+
+        } else {
+            /* over the budget, the body is inflated in the event loop */
+            ctx->overbudget = 0;
+        }
+    }
+
+    if (ctx->thread) {
+        rc = ngx_http_gunzip_request_thread_body(r, ctx, in);
+        if (rc == NGX_DECLINED) {
+            goto entity_too_large;
+        }
+        if (rc != NGX_OK) {
+            goto failed;
+        }
+
+        return NGX_OK;
+    }
+
+#endif
+
+    if (!ctx->started && in && in->next == NULL && in->buf->last_buf
+        && ngx_buf_in_memory_only(in->buf)
+        && ctx->coding->mask == NGX_HTTP_GUNZIP_REQUEST_CODING_GZIP)
+    {
+        if (ngx_http_gunzip_request_check_isize(r, in->buf) != NGX_OK) {
+            goto entity_too_large;
+        }
+    }
+
+    if (!ctx->started && in && conf->cache_zone
+        && ctx->coding->mask == NGX_HTTP_GUNZIP_REQUEST_CODING_GZIP)
+    {
+        rc = ngx_http_gunzip_request_cache_lookup(r, ctx, in);
+        if (rc == NGX_ERROR) {
+            goto failed;
+        }
+        if (rc == NGX_OK) {
+            in = NULL;
+        }
+    }
+
+    if (!ctx->started && in && conf->one_shot
+        && ctx->coding->mask == NGX_HTTP_GUNZIP_REQUEST_CODING_GZIP)
+    {
+        rc = ngx_http_gunzip_request_whole_body(r, ctx, in);
+        if (rc == NGX_ERROR) {
+            goto failed;
+        }
+        if (rc == NGX_OK) {
+            in = NULL;
+        }
+    }
+
+    if (!ctx->started) {
+        if (ngx_http_gunzip_request_inflate_start(r, ctx) != NGX_OK) {
+            goto failed;
+        }
+    }
+
+    if (in) {
+        if (ngx_chain_add_copy(r->pool, &ctx->in, in) != NGX_OK) {
+            goto failed;
+        }
+    }
+
+#if (NGX_HTTP_GUNZIP_REQUEST_NEED_BUFFERING)
+
+    if (ctx->slice_ev && ctx->slice_ev->posted) {
+        /* the pending slice goes on with the new input too */
+
+        if (ngx_http_gunzip_request_hold(r, ctx) != NGX_OK) {
+            goto failed;
+        }
+
+        return NGX_OK;
+    }
+
+#endif
+
+    if (ctx->nomem) {
+        /* flush busy buffers */
+        if (ngx_http_next_request_body_filter(r, NULL) == NGX_ERROR) {
+            goto failed;
+        }
+        cl = NULL;
+        ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &cl,
+                                (ngx_buf_tag_t) &ngx_http_gunzip_request_module);
+        ctx->nomem = 0;
+        flush = 0;
+    } else {
+        flush = ctx->busy ? 1 : 0;
+    }
+
+    sum = ctx->sum;
+    yield = 0;
+
+    for ( ;; ) {
+        /* cycle while we can write to a client */
+        for ( ;; ) {
+
+            /* cycle while there is data to feed zlib and ... */
+            rc = ngx_http_gunzip_request_add_data(r, ctx);
+            if (rc == NGX_DECLINED) {
+                break;
+            }
+            if (rc == NGX_AGAIN) {
+                continue;
+            }
+
+            /* ... there are buffers to write zlib output */
+            rc = ngx_http_gunzip_request_get_buf(r, ctx);
+            if (rc == NGX_DECLINED) {
+                if (ctx->spill && ctx->out) {
+                    break;
+                }
+
+                if (ctx->backpressure && (ctx->out || ctx->busy)) {
+                    if (ctx->out == NULL) {
+                        ngx_log_debug2(NGX_LOG_DEBUG_HTTP,
+                                       r->connection->log, 0,
+                                       "[gunzreq] wait for upstream: "
+                                       "in:%uz rest:%O",
+                                       ctx->io.avail_in,
+                                       r->request_body->rest);
+                        ngx_http_gunzip_request_stat(waits, 1);
+                    }
+                    break;
+                }
+
+                if (ctx->overbudget) {
+                    goto unavailable;
+                }
+
+                goto entity_too_large;
+            }
+            if (rc == NGX_ERROR) {
+                goto failed;
+            }
+
+            rc = ngx_http_gunzip_request_inflate(r, ctx);
+            if (rc == NGX_OK) {
+                break;
+            }
+            if (rc == NGX_ERROR) {
+                goto failed;
+            }
+            if (rc == NGX_DECLINED) {
+                goto entity_too_large;
+            }
+            /* rc == NGX_AGAIN */
+
+            if (conf->slice && ctx->sum - sum >= conf->slice) {
+                /* let other connections of the worker run */
+                yield = 1;
+                break;
+            }
+        }
+
+        if (ctx->out == NULL && !flush) {
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                    "[gunzreq] no out, no flush: busy=%d nomem=%d", ctx->busy != 0, ctx->nomem);
+
+            if (yield) {
+                goto slice;
+            }
+
+            return NGX_OK;
+            return ctx->busy ? NGX_AGAIN : NGX_OK;
+        }
+
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] next pre: out.size=%d", (ctx->out != NULL ? ngx_buf_size(ctx->out->buf) : -1));
+        if (ctx->spill) {
+            if (ngx_http_gunzip_request_spill(r, ctx, &cl) != NGX_OK) {
+                goto failed;
+            }
+
+        } else {
+            cl = ctx->out;
+        }
+
+        rc = ngx_http_next_request_body_filter(r, cl);
+        if (rc == NGX_ERROR) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                    "[gunzreq] error");
+            goto failed;
+        }
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] next post: out.size=%d", (ctx->out != NULL ? ngx_buf_size(ctx->out->buf) : -1));
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "[gunzreq] update_chains#2 pre: busy=%d out.size=%d",
+                       ctx->busy != 0,
+                       (ctx->out != NULL ?
+                       ngx_buf_size(ctx->out->buf) : -1));
+        ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &ctx->out,
+                                (ngx_buf_tag_t) &ngx_http_gunzip_request_module);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "[gunzreq] update_chains#2 post: busy=%d", ctx->busy != 0);
+        ctx->last_out = &ctx->out;
+
+        ctx->nomem = 0;
+        flush = 0;
+
+        if (ctx->done) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                    "[gunzreq] done: rc=%d", rc);
+            return rc;
+        }
+
+        if (yield) {
+            goto slice;
+        }
+    }
+
+    /* unreachable */
+
+slice:
+
+#if (NGX_HTTP_GUNZIP_REQUEST_NEED_BUFFERING)
+    if (ngx_http_gunzip_request_slice(r, ctx) != NGX_OK) {
+        goto failed;
+    }
+#endif
+
+    return NGX_OK;
+
+entity_too_large:
+    ngx_http_gunzip_request_stat(rejected, 1);
+    ctx->done = 1;
+    (void) ngx_http_discard_request_body(r);
+    ngx_http_finalize_request(r, NGX_HTTP_REQUEST_ENTITY_TOO_LARGE);
+    return NGX_OK;
+
+bad_request:
+    ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                  "[gunzreq] client sent %s body than its Content-Length",
+                  ctx->length < 0 ? "a longer" : "a shorter");
+    ctx->done = 1;
+    (void) ngx_http_discard_request_body(r);
+    ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
+    return NGX_OK;
+
+unavailable:
+    ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                  "[gunzreq] gunzip_request_memory_limit %uz exceeded",
+                  ngx_http_gunzip_request_memory_limit);
+    ctx->done = 1;
+    (void) ngx_http_discard_request_body(r);
+    ngx_http_finalize_request(r, NGX_HTTP_SERVICE_UNAVAILABLE);
+    return NGX_OK;
+
+failed:
+    ngx_http_gunzip_request_stat(errors, 1);
+    ctx->done = 1;
+    return NGX_ERROR;
+}
+
+
+#if (NGX_HTTP_GUNZIP_REQUEST_NEED_BUFFERING)
+
+/*
+ * input left for a later slice is copied, so nginx does not see its
+ * buffers busy and can go on reading the body
+ */
+
+static ngx_buf_t *
+ngx_http_gunzip_request_own(ngx_http_request_t *r, ngx_buf_t *b)
+{
+    size_t      size;
+    ngx_buf_t  *nb;
+
+    nb = ngx_calloc_buf(r->pool);
+    if (nb == NULL) {
+        return NULL;
+    }
+
+    /* flags, and the file part as it is */
+
+    *nb = *b;
+
+    nb->tag = (ngx_buf_tag_t) &ngx_http_gunzip_request_module;
+    nb->shadow = NULL;
+
+    if (ngx_buf_in_memory(b) && b->pos != b->last) {
+        size = b->last - b->pos;
+
+        nb->start = ngx_pnalloc(r->pool, size);
+        if (nb->start == NULL) {
+            return NULL;
+        }
+
+        nb->pos = nb->start;
+        nb->last = ngx_cpymem(nb->start, b->pos, size);
+        nb->end = nb->last;
+
+        nb->temporary = 1;
+        nb->memory = 0;
+        nb->mmap = 0;
+    }
+
+    b->pos = b->last;
+    b->file_pos = b->file_last;
+
+    return nb;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_hold(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx)
+{
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    b = ctx->in_buf;
+
+    if (b && b->tag != (ngx_buf_tag_t) &ngx_http_gunzip_request_module
+        && (ctx->io.avail_in || ngx_http_gunzip_request_file_left(b)))
+    {
+        ctx->in_buf = ngx_http_gunzip_request_own(r, b);
+        if (ctx->in_buf == NULL) {
+            return NGX_ERROR;
+        }
+
+        /* data read from a file are in ctx->file_buf already */
+
+        if (ctx->io.avail_in && ngx_buf_in_memory(ctx->in_buf)) {
+            ctx->io.next_in = ctx->in_buf->pos;
+        }
+    }
+
+    for (cl = ctx->in; cl; cl = cl->next) {
+        if (cl->buf->tag == (ngx_buf_tag_t) &ngx_http_gunzip_request_module) {
+            continue;
+        }
+
+        cl->buf = ngx_http_gunzip_request_own(r, cl->buf);
+        if (cl->buf == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_slice(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx)
+{
+    ngx_pool_cleanup_t  *cln;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] slice: sum:%uz in:%uz",
+                   ctx->sum, ctx->io.avail_in);
+
+    if (ngx_http_gunzip_request_hold(r, ctx) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ctx->slice_ev == NULL) {
+        ctx->slice_ev = ngx_pcalloc(r->pool, sizeof(ngx_event_t));
+        if (ctx->slice_ev == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_http_gunzip_request_slice_cleanup;
+        cln->data = ctx->slice_ev;
+
+        ctx->slice_ev->handler = ngx_http_gunzip_request_slice_handler;
+        ctx->slice_ev->data = r;
+        ctx->slice_ev->log = r->connection->log;
+    }
+
+    /* nginx waits for the last buffer of the body from us */
+    r->request_body->filter_need_buffering = 1;
+
+    /*
+     * ngx_posted_events is drained until it is empty, so a slice posted
+     * there would run again at once; ngx_posted_next_events waits for the
+     * next poll for I/O, and other connections are served in between
+     */
+
+    ngx_post_event(ctx->slice_ev, &ngx_posted_next_events);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gunzip_request_slice_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "[gunzreq] slice resume");
+
+    if (ngx_http_gunzip_request_body_filter(r, NULL) == NGX_ERROR) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+
+    } else {
+        /* let nginx notice that the body has been saved */
+        r->read_event_handler(r);
+    }
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_gunzip_request_slice_cleanup(void *data)
+{
+    ngx_event_t *ev = data;
+
+    if (ev->posted) {
+        ngx_delete_posted_event(ev);
+    }
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_gunzip_request_transcode_start(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx)
+{
+    ngx_pool_cleanup_t              *cln;
+    ngx_http_gunzip_request_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] transcode start: %V %i",
+                   &conf->transcode->engine.name, conf->transcode_level);
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->enc = ngx_http_gunzip_request_state_get(&conf->transcode->engine,
+                                                 r->connection->log);
+    if (ctx->enc == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_gunzip_request_transcode_cleanup;
+    cln->data = ctx;
+
+    return conf->transcode->level(ctx->enc->data, conf->transcode_level,
+                                  r->connection->log);
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_transcode_filter(ngx_http_request_t *r,
+    ngx_chain_t *in)
+{
+    size_t                          size;
+    ssize_t                         n;
+    ngx_int_t                       rc;
+    ngx_buf_t                      *b;
+    ngx_uint_t                      flush;
+    ngx_chain_t                    *cl, *out, **ll;
+    ngx_http_gunzip_request_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_gunzip_request_module);
+
+    if (ctx == NULL || ctx->enc == NULL) {
+        return ngx_http_next_transcode_filter(r, in);
+    }
+
+    out = NULL;
+    ll = &out;
+
+    for (cl = in; cl; cl = cl->next) {
+        b = cl->buf;
+
+        flush = b->last_buf ? NGX_HTTP_GUNZIP_REQUEST_FINISH
+                : b->flush ? NGX_HTTP_GUNZIP_REQUEST_SYNC_FLUSH
+                : NGX_HTTP_GUNZIP_REQUEST_NO_FLUSH;
+
+        if (ngx_buf_in_memory(b) || !b->in_file) {
+            size = ngx_buf_in_memory(b) ? (size_t) (b->last - b->pos) : 0;
+
+            if (ngx_http_gunzip_request_encode(r, ctx, b->pos, size, flush,
+                                               &ll)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            b->pos = b->last;
+            continue;
+        }
+
+        /* inflated data spilled to a temporary file */
+
+        if (ctx->enc_in == NULL) {
+            ctx->enc_in = ngx_create_temp_buf(r->pool,
+                                          NGX_HTTP_GUNZIP_REQUEST_TRANSCODE_BUF);
+            if (ctx->enc_in == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
+        while (b->file_pos < b->file_last) {
+            size = (size_t) ngx_min(b->file_last - b->file_pos,
+                                  NGX_HTTP_GUNZIP_REQUEST_TRANSCODE_BUF);
+
+            n = ngx_read_file(b->file, ctx->enc_in->start, size, b->file_pos);
+
+            if (n == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            if ((size_t) n != size) {
+                ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                              ngx_read_file_n " read only %z of %uz from \"%V\"",
+                              n, size, &b->file->name);
+                return NGX_ERROR;
+            }
+
+            b->file_pos += n;
+
+            if (ngx_http_gunzip_request_encode(r, ctx, ctx->enc_in->start,
+                                    size,
+                                    b->file_pos < b->file_last
+                                    ? NGX_HTTP_GUNZIP_REQUEST_NO_FLUSH : flush,
+                                    &ll)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    if (out == NULL && in) {
+        /* the encoder keeps it for now */
+        return NGX_OK;
+    }
+
+    rc = ngx_http_next_transcode_filter(r, out);
+
+    ngx_chain_update_chains(r->pool, &ctx->enc_free, &ctx->enc_busy, &out,
+                            (ngx_buf_tag_t) &ngx_http_gunzip_request_module);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_encode(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx, u_char *p, size_t size,
+    ngx_uint_t flush, ngx_chain_t ***ll)
+{
+    ngx_int_t                      rc;
+    ngx_buf_t                     *b;
+    ngx_chain_t                   *cl;
+    ngx_http_gunzip_request_io_t   io;
+
+    if (size == 0 && flush == NGX_HTTP_GUNZIP_REQUEST_NO_FLUSH) {
+        return NGX_OK;
+    }
+
+    io.next_in = p;
+    io.avail_in = size;
+
+    for ( ;; ) {
+
+        if (ctx->enc_buf == NULL) {
+
+            if (ctx->enc_free) {
+                ctx->enc_buf = ctx->enc_free->buf;
+                ctx->enc_free = ctx->enc_free->next;
+                ctx->enc_buf->flush = 0;
+
+            } else {
+                ctx->enc_buf = ngx_create_temp_buf(r->pool,
+                                          NGX_HTTP_GUNZIP_REQUEST_TRANSCODE_BUF);
+                if (ctx->enc_buf == NULL) {
+                    return NGX_ERROR;
+                }
+
+                ctx->enc_buf->tag = (ngx_buf_tag_t)
+                                                &ngx_http_gunzip_request_module;
+                ctx->enc_buf->recycled = 1;
+            }
+        }
+
+        b = ctx->enc_buf;
+
+        io.next_out = b->last;
+        io.avail_out = b->end - b->last;
+
+        rc = ctx->enc->engine->feed(ctx->enc->data, &io, flush,
+                                    r->connection->log);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (rc == NGX_AGAIN && io.next_out == b->pos) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          "[gunzreq] %V encoder stalled",
+                          &ctx->enc->engine->name);
+            return NGX_ERROR;
+        }
+
+        b->last = io.next_out;
+
+        if (rc == NGX_OK
+            && (flush == NGX_HTTP_GUNZIP_REQUEST_NO_FLUSH
+                || (flush == NGX_HTTP_GUNZIP_REQUEST_SYNC_FLUSH
+                    && b->last == b->pos)))
+        {
+            /* the rest of the buffer is filled by next data */
+            return NGX_OK;
+        }
+
+        /* the buffer is full, or everything so far is written out */
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = b;
+        cl->next = NULL;
+        **ll = cl;
+        *ll = &cl->next;
+
+        ctx->enc_buf = NULL;
+        ctx->enc_sum += b->last - b->pos;
+
+        if (rc == NGX_AGAIN) {
+            continue;
+        }
+
+        if (flush == NGX_HTTP_GUNZIP_REQUEST_SYNC_FLUSH) {
+            b->flush = 1;
+            return NGX_OK;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "[gunzreq] transcode end: %O", ctx->enc_sum);
+
+        b->last_buf = (r == r->main) ? 1 : 0;
+        b->last_in_chain = 1;
+
+        r->headers_in.content_length_n = ctx->enc_sum;
+
+        ngx_http_gunzip_request_transcode_cleanup(ctx);
+
+        return NGX_OK;
     }
+}
 
-    return NGX_OK;
+
+static void
+ngx_http_gunzip_request_transcode_cleanup(void *data)
+{
+    ngx_http_gunzip_request_ctx_t *ctx = data;
+
+    if (ctx->enc) {
+        ngx_http_gunzip_request_state_put(ctx->enc);
+        ctx->enc = NULL;
+    }
 }
 
+
 static ngx_int_t
-ngx_http_gunzip_request_get_buf(ngx_http_request_t *r,
-    ngx_http_gunzip_request_ctx_t *ctx)
+ngx_http_gunzip_request_cache_lookup(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx, ngx_chain_t *in)
 {
-    ngx_http_gunzip_request_conf_t  *conf;
+    u_char                                *p;
+    size_t                                 len, isize;
+    uint32_t                               key;
+    ngx_buf_t                             *b, *out;
+    ngx_http_gunzip_request_conf_t        *conf;
+    ngx_http_gunzip_request_cache_t       *cache;
+    ngx_http_gunzip_request_cache_node_t  *e;
 
-    if (ctx->zstream.avail_out) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] get_buf: case#0");
-        return NGX_OK;
+    b = in->buf;
+
+    /* same bodies as gunzip_request_one_shot takes */
+
+    if (in->next || !b->last_buf || !ngx_buf_in_memory_only(b)
+        || b->last - b->pos < 18)
+    {
+        return NGX_DECLINED;
     }
 
     conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
 
-    if (ctx->free) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] get_buf: case#1");
-        ctx->out_buf = ctx->free->buf;
-        ctx->free = ctx->free->next;
+    isize = ngx_http_gunzip_request_isize(b);
 
-        ctx->out_buf->flush = 0;
+    if (isize == 0 || isize > conf->cache_max_size) {
+        return NGX_DECLINED;
+    }
 
-    } else if (ctx->bufs < conf->bufs.num) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] get_buf: case#2");
+    /* CRC32 of gzip trailer, little endian */
 
-        ctx->out_buf = ngx_create_temp_buf(r->pool, conf->bufs.size);
-        if (ctx->out_buf == NULL) {
+    p = b->last - 8;
+    key = (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16
+          | (uint32_t) p[3] << 24;
+
+    len = b->last - b->pos;
+    cache = conf->cache_zone->data;
+    out = NULL;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    e = ngx_http_gunzip_request_cache_find(cache, key, b->pos, len);
+
+    if (e) {
+        ngx_queue_remove(&e->queue);
+        ngx_queue_insert_head(&cache->sh->queue, &e->queue);
+
+        out = ngx_create_temp_buf(r->pool, e->out_len);
+
+        if (out) {
+            out->last = ngx_cpymem(out->pos, e->data + e->in_len, e->out_len);
+        }
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[gunzreq] cache %s: key:%08XD len:%uz",
+                   e ? "hit" : "miss", key, len);
+
+    if (e == NULL) {
+        ngx_http_gunzip_request_stat(cache_misses, 1);
+
+        /* the input buffer may be reused before the body is inflated */
+
+        ctx->cache_in = ngx_pnalloc(r->pool, len);
+        if (ctx->cache_in == NULL) {
             return NGX_ERROR;
         }
 
-        ctx->out_buf->tag = (ngx_buf_tag_t) &ngx_http_gunzip_request_module;
-        ctx->out_buf->recycled = 1;
-        ctx->bufs++;
+        ngx_memcpy(ctx->cache_in, b->pos, len);
+        ctx->cache_len = len;
+        ctx->cache_key = key;
 
-    } else {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] get_buf: case#3");
-        ctx->nomem = 1;
         return NGX_DECLINED;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] get_buf: case#4");
-    ctx->zstream.next_out = ctx->out_buf->pos;
-    ctx->zstream.avail_out = conf->bufs.size;
+    if (out == NULL) {
+        return NGX_ERROR;
+    }
 
-    return NGX_OK;
+    ngx_http_gunzip_request_stat(cache_hits, 1);
+
+    b->pos = b->last;
+
+    ctx->out_buf = out;
+    ctx->sum = out->last - out->pos;
+    ctx->received = len;
+
+    ctx->request = r;
+    ctx->started = 1;
+    ctx->last_out = &ctx->out;
+
+    return ngx_http_gunzip_request_inflate_end(r, ctx);
 }
 
-static ngx_int_t
-ngx_http_gunzip_request_inflate(ngx_http_request_t *r,
-    ngx_http_gunzip_request_ctx_t *ctx)
+
+static void
+ngx_http_gunzip_request_cache_store(ngx_http_request_t *r,
+    ngx_http_gunzip_request_ctx_t *ctx, ngx_buf_t *b)
 {
-    int           rc;
-    ngx_buf_t    *b;
-    ngx_chain_t  *cl;
-    size_t        curr;
-    ngx_http_gunzip_request_conf_t *conf;
+    size_t                                 size;
+    ngx_queue_t                           *q;
+    ngx_http_gunzip_request_conf_t        *conf;
+    ngx_http_gunzip_request_cache_t       *cache;
+    ngx_http_gunzip_request_cache_node_t  *e, *old;
 
-    curr = ctx->zstream.avail_out;
-    ngx_log_debug6(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "[gunzreq] inflate in: ni:%p no:%p ai:%ud ao:%ud fl:%d redo:%d",
-                   ctx->zstream.next_in, ctx->zstream.next_out,
-                   ctx->zstream.avail_in, ctx->zstream.avail_out,
-                   ctx->flush, ctx->redo);
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
+
+    if (ctx->sum > conf->cache_max_size) {
+        return;
+    }
 
-    rc = inflate(&ctx->zstream, ctx->flush);
+    cache = conf->cache_zone->data;
 
-    if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                      "[gunzreq] inflate() failed: %d, %d", ctx->flush, rc);
-        return NGX_ERROR;
+    size = offsetof(ngx_http_gunzip_request_cache_node_t, data)
+           + ctx->cache_len + ctx->sum;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    /* another worker may have stored the same body meanwhile */
+
+    if (ngx_http_gunzip_request_cache_find(cache, ctx->cache_key,
+                                           ctx->cache_in, ctx->cache_len))
+    {
+        goto done;
     }
 
-    if (curr > ctx->zstream.avail_out) {
-        ctx->sum += curr - ctx->zstream.avail_out;
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "[gunzreq] inflate and update sum: %d", ctx->sum);
+    for ( ;; ) {
+        e = ngx_slab_alloc_locked(cache->shpool, size);
 
-        // check overflow of inflate size against zip bomb
-        conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
-        if (conf->max_inflate_size > 0 && ctx->sum > conf->max_inflate_size) {
-            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                    "[gunzreq] overflow max inflate size: %d > %d", ctx->sum, conf->max_inflate_size);
-            return NGX_DECLINED;
+        if (e || ngx_queue_empty(&cache->sh->queue)) {
+            break;
         }
+
+        q = ngx_queue_last(&cache->sh->queue);
+        old = ngx_queue_data(q, ngx_http_gunzip_request_cache_node_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->sh->rbtree, &old->node);
+        ngx_slab_free_locked(cache->shpool, old);
     }
-    ngx_log_debug5(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "[gunzreq] inflate out: ni:%p no:%p ai:%ud ao:%ud rc:%d",
-                   ctx->zstream.next_in, ctx->zstream.next_out,
-                   ctx->zstream.avail_in, ctx->zstream.avail_out,
-                   rc);
+
+    if (e == NULL) {
+        goto done;
+    }
+
+    e->node.key = ctx->cache_key;
+    e->in_len = ctx->cache_len;
+    e->out_len = ctx->sum;
+
+    ngx_memcpy(e->data, ctx->cache_in, ctx->cache_len);
+    ngx_memcpy(e->data + ctx->cache_len, b->pos, ctx->sum);
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &e->node);
+    ngx_queue_insert_head(&cache->sh->queue, &e->queue);
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "[gunzreq] gunzip in_buf:%p pos:%p",
-                   ctx->in_buf, ctx->in_buf->pos);
+                   "[gunzreq] cache store: key:%08XD size:%uz",
+                   ctx->cache_key, size);
+
+done:
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ctx->cache_in = NULL;
+}
+
 
-    if (ctx->zstream.next_in) {
-        ctx->in_buf->pos = ctx->zstream.next_in;
+/*
+ * Entries are ordered by the key, then by compressed bodies themselves,
+ * so a hit is never a hash collision.
+ */
 
-        if (ctx->zstream.avail_in == 0) {
-            ctx->zstream.next_in = NULL;
+static ngx_http_gunzip_request_cache_node_t *
+ngx_http_gunzip_request_cache_find(ngx_http_gunzip_request_cache_t *cache,
+    uint32_t key, u_char *p, size_t len)
+{
+    ngx_int_t                              rc;
+    ngx_rbtree_node_t                     *node, *sentinel;
+    ngx_http_gunzip_request_cache_node_t  *e;
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* key == node->key */
+
+        e = (ngx_http_gunzip_request_cache_node_t *) node;
+
+        rc = ngx_memn2cmp(p, e->data, len, e->in_len);
+
+        if (rc == 0) {
+            return e;
         }
+
+        node = (rc < 0) ? node->left : node->right;
     }
 
-    ctx->out_buf->last = ctx->zstream.next_out;
+    return NULL;
+}
 
-    if (ctx->zstream.avail_out == 0) {
 
-        /* zlib wants to output some more data */
+static void
+ngx_http_gunzip_request_cache_insert(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t                    **p;
+    ngx_http_gunzip_request_cache_node_t  *e, *et;
 
-        cl = ngx_alloc_chain_link(r->pool);
-        if (cl == NULL) {
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            e = (ngx_http_gunzip_request_cache_node_t *) node;
+            et = (ngx_http_gunzip_request_cache_node_t *) temp;
+
+            p = (ngx_memn2cmp(e->data, et->data, e->in_len, et->in_len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+static ngx_int_t
+ngx_http_gunzip_request_status_handler(ngx_http_request_t *r)
+{
+    size_t                              size;
+    ngx_int_t                           rc;
+    ngx_buf_t                          *b;
+    ngx_uint_t                          i, n;
+    ngx_chain_t                         out;
+    ngx_atomic_uint_t                   value;
+    ngx_http_gunzip_request_stats_t    *stats;
+    ngx_http_gunzip_request_counter_t  *c;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    stats = ngx_http_gunzip_request_stats;
+
+    if (stats == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ngx_str_set(&r->headers_out.content_type, "text/plain; version=0.0.4");
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+    r->headers_out.content_type_lowcase = NULL;
+
+    size = 0;
+
+    for (c = ngx_http_gunzip_request_counters; c->name.len; c++) {
+        size += sizeof("# HELP  \n# TYPE  counter\n \n") - 1
+                + 3 * c->name.len + c->help.len + NGX_ATOMIC_T_LEN;
+    }
+
+    size += sizeof("# HELP gunzip_request_memory_bytes "
+                   "Inflated data buffers in use.\n"
+                   "# TYPE gunzip_request_memory_bytes gauge\n"
+                   "gunzip_request_memory_bytes \n") - 1 + NGX_ATOMIC_T_LEN;
+
+    size += sizeof("# TYPE gunzip_request_inflate_seconds histogram\n") - 1
+            + (NGX_HTTP_GUNZIP_REQUEST_BUCKETS + 2)
+              * (sizeof("gunzip_request_inflate_seconds_bucket{le=\"0.000000\"} \n")
+                 - 1 + NGX_ATOMIC_T_LEN);
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    for (c = ngx_http_gunzip_request_counters; c->name.len; c++) {
+        value = *(ngx_atomic_t *) ((u_char *) stats + c->offset);
+
+        b->last = ngx_sprintf(b->last, "# HELP %V %V\n# TYPE %V counter\n"
+                              "%V %uA\n",
+                              &c->name, &c->help, &c->name, &c->name, value);
+    }
+
+    value = stats->memory;
+
+    b->last = ngx_sprintf(b->last, "# HELP gunzip_request_memory_bytes "
+                                   "Inflated data buffers in use.\n"
+                                   "# TYPE gunzip_request_memory_bytes gauge\n"
+                                   "gunzip_request_memory_bytes %uA\n",
+                          value);
+
+    b->last = ngx_cpymem(b->last,
+                       "# TYPE gunzip_request_inflate_seconds histogram\n",
+                       sizeof("# TYPE gunzip_request_inflate_seconds histogram\n")
+                       - 1);
+
+    n = 0;
+
+    for (i = 0; i < NGX_HTTP_GUNZIP_REQUEST_BUCKETS; i++) {
+        n += stats->latency[i];
+
+        if (i == NGX_HTTP_GUNZIP_REQUEST_BUCKETS - 1) {
+            b->last = ngx_sprintf(b->last,
+                          "gunzip_request_inflate_seconds_bucket{le=\"+Inf\"} "
+                          "%ui\n", n);
+            break;
+        }
+
+        b->last = ngx_sprintf(b->last,
+                          "gunzip_request_inflate_seconds_bucket{le=\"%ui.%06ui\"} "
+                          "%ui\n",
+                          ngx_http_gunzip_request_buckets[i] / 1000000,
+                          ngx_http_gunzip_request_buckets[i] % 1000000, n);
+    }
+
+    value = stats->usec;
+
+    b->last = ngx_sprintf(b->last,
+                          "gunzip_request_inflate_seconds_sum %uA.%06uA\n"
+                          "gunzip_request_inflate_seconds_count %ui\n",
+                          value / 1000000, value % 1000000, n);
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_gunzip_request_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
             return NGX_ERROR;
         }
 
-        cl->buf = ctx->out_buf;
-        cl->next = NULL;
-        *ctx->last_out = cl;
-        ctx->last_out = &cl->next;
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
 
-        ctx->redo = 1;
+    return NGX_OK;
+}
 
-        return NGX_AGAIN;
+
+static ngx_int_t
+ngx_http_gunzip_request_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char                         *p;
+    ngx_uint_t                      ratio;
+    ngx_http_gunzip_request_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_gunzip_request_module);
+
+    if (ctx == NULL || !ctx->started) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_OFF_T_LEN + 4);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    switch (data) {
+
+    case 0:
+        v->len = ngx_sprintf(p, "%O", ctx->received) - p;
+        break;
+
+    case 1:
+        v->len = ngx_sprintf(p, "%uz", ctx->sum) - p;
+        break;
+
+    case 2:
+        ratio = ctx->received ? (ngx_uint_t) (ctx->sum * 100 / ctx->received)
+                              : 0;
+        v->len = ngx_sprintf(p, "%ui.%02ui", ratio / 100, ratio % 100) - p;
+        break;
+
+    default: /* 3 */
+        v->len = ngx_sprintf(p, "%ui.%03ui", ctx->usec / 1000000,
+                             ctx->usec % 1000000 / 1000) - p;
+        break;
     }
 
-    ctx->redo = 0;
+    v->valid = 1;
+    v->no_cacheable = 1;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
+static ngx_table_elt_t *
+ngx_http_gunzip_request_find_header(ngx_http_request_t *r, ngx_str_t *name,
+    ngx_uint_t hash)
+{
+    ngx_uint_t        i;
+    ngx_list_part_t  *part;
+    ngx_table_elt_t  *header;
+
+    part = &r->headers_in.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
 
-    if (ctx->flush == Z_SYNC_FLUSH) {
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
 
-        ctx->flush = Z_NO_FLUSH;
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
 
-        cl = ngx_alloc_chain_link(r->pool);
-        if (cl == NULL) {
-            return NGX_ERROR;
+        if (header[i].hash != hash || header[i].key.len != name->len) {
+            continue;
         }
 
-        b = ctx->out_buf;
+        if (ngx_strncasecmp(header[i].key.data, name->data, name->len) == 0) {
+            return &header[i];
+        }
+    }
 
-        if (ngx_buf_size(b) == 0) {
+    return NULL;
+}
 
-            b = ngx_calloc_buf(ctx->request->pool);
-            if (b == NULL) {
-                return NGX_ERROR;
-            }
 
-        } else {
-            ctx->zstream.avail_out = 0;
-        }
+static ngx_http_gunzip_request_dict_t *
+ngx_http_gunzip_request_dictionary_find(ngx_http_request_t *r)
+{
+    ngx_str_t                             id;
+    ngx_uint_t                            i;
+    ngx_table_elt_t                      *h;
+    ngx_http_gunzip_request_dict_t       *dict;
+    ngx_http_gunzip_request_main_conf_t  *gmcf;
 
-        b->flush = 1;
+    gmcf = ngx_http_get_module_main_conf(r, ngx_http_gunzip_request_module);
 
-        cl->buf = b;
-        cl->next = NULL;
-        *ctx->last_out = cl;
-        ctx->last_out = &cl->next;
+    if (gmcf->dictionaries == NULL) {
+        return NULL;
+    }
 
-        return NGX_OK;
+    h = ngx_http_gunzip_request_find_header(r,
+                                        &ngx_http_gunzip_request_dictionary_id,
+                                        ngx_http_gunzip_request_dictionary_hash);
+    if (h == NULL) {
+        return NULL;
     }
 
-    if (ctx->flush == Z_FINISH && ctx->zstream.avail_in == 0) {
+    /* a structured field string, "id", or a bare token */
 
-        if (rc != Z_STREAM_END) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                          "[gunzreq] inflate() returned %d on response end", rc);
-            return NGX_ERROR;
-        }
+    id = h->value;
 
-        if (ngx_http_gunzip_request_inflate_end(r, ctx) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    if (id.len >= 2 && id.data[0] == '"' && id.data[id.len - 1] == '"') {
+        id.data++;
+        id.len -= 2;
+    }
 
-        return NGX_OK;
+    dict = gmcf->dictionaries->elts;
+
+    for (i = 0; i < gmcf->dictionaries->nelts; i++) {
+        if (dict[i].id.len == id.len
+            && ngx_strncmp(dict[i].id.data, id.data, id.len) == 0)
+        {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "[gunzreq] dictionary \"%V\"", &id);
+            return &dict[i];
+        }
     }
 
-    if (rc == Z_STREAM_END && ctx->zstream.avail_in > 0) {
+    ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                  "[gunzreq] unknown dictionary \"%V\"", &h->value);
+
+    return NULL;
+}
 
-        rc = inflateReset(&ctx->zstream);
 
-        if (rc != Z_OK) {
-            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
-                          "[gunzreq] inflateReset() failed: %d", rc);
-            return NGX_ERROR;
+static ngx_http_gunzip_request_ctx_t *
+ngx_http_gunzip_request_detect(ngx_http_request_t *r,
+    ngx_http_gunzip_request_conf_t *conf)
+{
+    ngx_str_t                          value;
+    ngx_table_elt_t                   *h;
+    ngx_http_gunzip_request_ctx_t     *ctx;
+    ngx_http_gunzip_request_coding_t  *coding;
+
+    if (conf->enable_value) {
+        if (ngx_http_complex_value(r, conf->enable_value, &value) != NGX_OK) {
+            return NULL;
         }
 
-        ctx->redo = 1;
+        if (value.len == 0
+            || (value.len == 1 && value.data[0] == '0')
+            || (value.len == 3
+                && ngx_strncasecmp(value.data, (u_char *) "off", 3) == 0))
+        {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "[gunzreq] off by \"%V\"", &value);
 
-        return NGX_AGAIN;
-    }
+            ctx = &ngx_http_gunzip_request_identity;
+            ngx_http_set_ctx(r, ctx, ngx_http_gunzip_request_module);
 
-    if (ctx->in == NULL) {
+            return ctx;
+        }
+    }
 
-        b = ctx->out_buf;
+    h = ngx_http_gunzip_request_find_header(r,
+                                       &ngx_http_gunzip_request_content_encoding,
+                                       ngx_http_gunzip_request_header_hash);
 
-        if (ngx_buf_size(b) == 0) {
-            return NGX_OK;
-        }
+    coding = h ? ngx_http_gunzip_request_find_coding(&h->value, conf->codings)
+               : NULL;
 
-        cl = ngx_alloc_chain_link(r->pool);
-        if (cl == NULL) {
-            return NGX_ERROR;
-        }
+    if (coding == NULL) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "[gunzreq] thru");
 
-        ctx->zstream.avail_out = 0;
+        ctx = &ngx_http_gunzip_request_identity;
+        ngx_http_set_ctx(r, ctx, ngx_http_gunzip_request_module);
 
-        cl->buf = b;
-        cl->next = NULL;
-        *ctx->last_out = cl;
-        ctx->last_out = &cl->next;
+        return ctx;
+    }
 
-        return NGX_OK;
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_gunzip_request_ctx_t));
+    if (ctx == NULL) {
+        return NULL;
     }
 
-    return NGX_AGAIN;
+    ctx->coding = coding;
+    ctx->header = h;
+
+    ngx_http_set_ctx(r, ctx, ngx_http_gunzip_request_module);
+
+    return ctx;
 }
 
+
 static ngx_int_t
-ngx_http_gunzip_request_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+ngx_http_gunzip_request_handler(ngx_http_request_t *r)
 {
-    ngx_http_gunzip_request_conf_t *conf;
-    ngx_uint_t              i;
-    ngx_list_part_t        *part;
-    ngx_table_elt_t        *header;
-    ngx_int_t               decompress = 0;
-    ngx_http_gunzip_request_ctx_t  *ctx;
-    ngx_uint_t              flush;
-    ngx_chain_t            *cl;
-    int                     rc;
+    ngx_http_gunzip_request_ctx_t   *ctx;
+    ngx_http_gunzip_request_conf_t  *conf;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] filter invoked");
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
 
-    for (cl = in; cl; cl = cl->next) {
-        ngx_log_debug7(NGX_LOG_DEBUG_EVENT, r->connection->log, 0,
-                       "[gunzreq] new buf t:%d f:%d %p, pos %p, size: %z "
-                       "file: %O, size: %O",
-                       cl->buf->temporary, cl->buf->in_file,
-                       cl->buf->start, cl->buf->pos,
-                       cl->buf->last - cl->buf->pos,
-                       cl->buf->file_pos,
-                       cl->buf->file_last - cl->buf->file_pos);
+    if (!conf->enable
+        || ngx_http_get_module_ctx(r, ngx_http_gunzip_request_module))
+    {
+        return NGX_DECLINED;
     }
 
-    conf = ngx_http_get_module_loc_conf(r, ngx_http_gunzip_request_module);
-    if (!conf->enable) {
-        return ngx_http_next_request_body_filter(r, in);
-    }
+    /* decided once per request, the body filter only checks ctx */
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_gunzip_request_module);
+    ctx = ngx_http_gunzip_request_detect(r, conf);
     if (ctx == NULL) {
-        ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_gunzip_request_ctx_t));
-        if (ctx == NULL) {
-            return NGX_ERROR;
-        }
-        ngx_http_set_ctx(r, ctx, ngx_http_gunzip_request_module);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    if (ctx->done || ctx->skip) {
-        return ngx_http_next_request_body_filter(r, in);
-    }
+    /*
+     * gunzip_request_stream: an unbuffered HTTP/2 or HTTP/3 body is passed
+     * on chunked as it is inflated.  The upstream request may be created
+     * before the body filter is called, so the length is dropped here
+     * already; whether the body is buffered is not known yet, and the
+     * body filter puts the length back then.  nginx no longer checks the
+     * dropped length, it is done in the body filter
+     */
+
+    if (conf->stream && !ctx->skip && r == r->main
+        && r->http_version >= NGX_HTTP_VERSION_20
+        && r->headers_in.content_length_n > 0
+        && (conf->transcode == NULL
+            || conf->transcode->mask != ctx->coding->mask))
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "[gunzreq] stream: drop content length %O",
+                       r->headers_in.content_length_n);
 
-    if (!ctx->checked) {
-        part = &r->headers_in.headers.part;
-        header = part->elts;
-        for (i = 0; /* void */; i++) {
-            if (i >= part->nelts) {
-                if (part->next == NULL) {
-                    break;
-                }
-                part = part->next;
-                header = part->elts;
-                i = 0;
-            }
-            if (header[i].key.len == sizeof("Content-Encoding") - 1
-                    && ngx_strncasecmp(header[i].key.data,
-                        (u_char *) "Content-Encoding",
-                        sizeof("Content-Encoding") - 1) == 0
-                    && header[i].value.len == 4
-                    && ngx_strncasecmp(header[i].value.data,
-                        (u_char *) "gzip", 4) == 0)
-            {
-                ngx_str_set(&header[i].value, "identity");
-                decompress = 1;
-                break;
-            }
-        }
+        ctx->stream = 1;
+        ctx->length = r->headers_in.content_length_n;
+        ctx->content_length = r->headers_in.content_length;
 
-        ctx->checked = 1;
-        if (!decompress) {
-            ctx->skip = 1;
-            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] thru");
-            rc = ngx_http_next_request_body_filter(r, in);
-            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] thru next post: rc=%d busy.size=%d", rc, (ctx->busy != NULL ? ngx_buf_size(ctx->busy->buf) : -1));
-            return rc;
-        }
+        r->headers_in.content_length = NULL;
+        r->headers_in.content_length_n = -1;
+        r->headers_in.chunked = 1;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] decompress request body");
+    return NGX_DECLINED;
+}
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_gunzip_request_module);
-    if (ctx != NULL && ctx->done) {
-        return ngx_http_next_request_body_filter(r, in);
-    }
-    if (ctx == NULL) {
-        ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_gunzip_request_ctx_t));
-        if (ctx == NULL) {
-            return NGX_ERROR;
-        }
-        ngx_http_set_ctx(r, ctx, ngx_http_gunzip_request_module);
-    }
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                "[gunzreq] available ctx: busy=%d", ctx->busy != 0);
+static ngx_int_t
+ngx_http_gunzip_request_init(ngx_conf_t *cf)
+{
+    ngx_http_handler_pt        *h;
+    ngx_http_core_main_conf_t  *cmcf;
 
-    if (!ctx->started) {
-        if (ngx_http_gunzip_request_inflate_start(r, ctx) != NGX_OK) {
-            goto failed;
-        }
-    }
+    /* re-encoding sees what the gunzip filter passes on */
 
-    if (in) {
-        if (ngx_chain_add_copy(r->pool, &ctx->in, in) != NGX_OK) {
-            goto failed;
-        }
-    }
+    ngx_http_next_transcode_filter = ngx_http_top_request_body_filter;
+    ngx_http_top_request_body_filter = ngx_http_gunzip_request_transcode_filter;
 
-    if (ctx->nomem) {
-        /* flush busy buffers */
-        if (ngx_http_next_request_body_filter(r, NULL) == NGX_ERROR) {
-            goto failed;
-        }
-        cl = NULL;
-        ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &cl,
-                                (ngx_buf_tag_t) &ngx_http_gunzip_request_module);
-        ctx->nomem = 0;
-        flush = 0;
-    } else {
-        flush = ctx->busy ? 1 : 0;
-    }
+    ngx_http_next_request_body_filter = ngx_http_top_request_body_filter;
+    ngx_http_top_request_body_filter = ngx_http_gunzip_request_body_filter;
 
-    for ( ;; ) {
-        /* cycle while we can write to a client */
-        for ( ;; ) {
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
 
-            /* cycle while there is data to feed zlib and ... */
-            rc = ngx_http_gunzip_request_add_data(r, ctx);
-            if (rc == NGX_DECLINED) {
-                break;
-            }
-            if (rc == NGX_AGAIN) {
-                continue;
-            }
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_PRECONTENT_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
 
-            /* ... there are buffers to write zlib output */
-            rc = ngx_http_gunzip_request_get_buf(r, ctx);
-            if (rc == NGX_DECLINED) {
-                goto entity_too_large;
-            }
-            if (rc == NGX_ERROR) {
-                goto failed;
-            }
+    *h = ngx_http_gunzip_request_handler;
 
-            rc = ngx_http_gunzip_request_inflate(r, ctx);
-            if (rc == NGX_OK) {
-                break;
-            }
-            if (rc == NGX_ERROR) {
-                goto failed;
-            }
-            if (rc == NGX_DECLINED) {
-                goto entity_too_large;
-            }
-            /* rc == NGX_AGAIN */
-        }
+    ngx_http_gunzip_request_identity.checked = 1;
+    ngx_http_gunzip_request_identity.skip = 1;
 
-        if (ctx->out == NULL && !flush) {
-            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                    "[gunzreq] no out, no flush: busy=%d nomem=%d", ctx->busy != 0, ctx->nomem);
-            return NGX_OK;
-            return ctx->busy ? NGX_AGAIN : NGX_OK;
-        }
+    ngx_http_gunzip_request_header_hash =
+                      ngx_hash_key((u_char *) "content-encoding",
+                                   sizeof("content-encoding") - 1);
 
+    ngx_http_gunzip_request_dictionary_hash =
+                      ngx_hash_key((u_char *) "dictionary-id",
+                                   sizeof("dictionary-id") - 1);
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] next pre: out.size=%d", (ctx->out != NULL ? ngx_buf_size(ctx->out->buf) : -1));
-        rc = ngx_http_next_request_body_filter(r, ctx->out);
-        if (rc == NGX_ERROR) {
-            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                    "[gunzreq] error");
-            goto failed;
-        }
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "[gunzreq] next post: out.size=%d", (ctx->out != NULL ? ngx_buf_size(ctx->out->buf) : -1));
+    return NGX_OK;
+}
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "[gunzreq] update_chains#2 pre: busy=%d out.size=%d",
-                       ctx->busy != 0,
-                       (ctx->out != NULL ?
-                       ngx_buf_size(ctx->out->buf) : -1));
-        ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &ctx->out,
-                                (ngx_buf_tag_t) &ngx_http_gunzip_request_module);
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "[gunzreq] update_chains#2 post: busy=%d", ctx->busy != 0);
-        ctx->last_out = &ctx->out;
 
-        ctx->nomem = 0;
-        flush = 0;
+static ngx_int_t
+ngx_http_gunzip_request_init_module(ngx_cycle_t *cycle)
+{
+    ngx_http_gunzip_request_main_conf_t  *gmcf;
 
-        if (ctx->done) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                    "[gunzreq] done: rc=%d", rc);
-            return rc;
-        }
+    gmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_gunzip_request_module);
+    if (gmcf == NULL) {
+        return NGX_OK;
     }
 
-    /* unreachable */
+    ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                  "[gunzreq] using \"%V\" inflate engine, %s crc32",
+                  &gmcf->engine->name, ngx_http_gunzip_request_crc32_init());
 
-entity_too_large:
-    ctx->done = 1;
-    (void) ngx_http_discard_request_body(r);
-    ngx_http_finalize_request(r, NGX_HTTP_REQUEST_ENTITY_TOO_LARGE);
     return NGX_OK;
-
-failed:
-    ctx->done = 1;
-    return NGX_ERROR;
 }
 
+
 static ngx_int_t
-ngx_http_gunzip_request_init(ngx_conf_t *cf)
+ngx_http_gunzip_request_init_process(ngx_cycle_t *cycle)
 {
-    ngx_http_next_request_body_filter = ngx_http_top_request_body_filter;
-    ngx_http_top_request_body_filter = ngx_http_gunzip_request_body_filter;
+    ngx_http_gunzip_request_main_conf_t  *gmcf;
+
+    gmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_gunzip_request_module);
+    if (gmcf) {
+        ngx_http_gunzip_request_pool_size = gmcf->pool_size;
+        ngx_http_gunzip_request_memory_limit = gmcf->memory_limit;
+
+        ngx_http_gunzip_request_stats = gmcf->shm_zone ? gmcf->shm_zone->data
+                                                       : NULL;
+
+        ngx_http_gunzip_request_dictionaries = gmcf->dictionaries;
+    }
 
     return NGX_OK;
 }
+
+
+static void
+ngx_http_gunzip_request_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                         i;
+    ngx_http_gunzip_request_coding_t  *coding;
+
+    ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                  "[gunzreq] inflate pool: hits:%ui misses:%ui",
+                  ngx_http_gunzip_request_pool_hits,
+                  ngx_http_gunzip_request_pool_misses);
+
+    for (i = 0; ngx_http_gunzip_request_engines[i]; i++) {
+        ngx_http_gunzip_request_pool_destroy(
+                                          ngx_http_gunzip_request_engines[i]);
+    }
+
+    for (coding = ngx_http_gunzip_request_codings; coding->name.len; coding++) {
+        if (coding->engine) {
+            ngx_http_gunzip_request_pool_destroy(coding->engine);
+        }
+    }
+
+    for (i = 0; ngx_http_gunzip_request_encoders[i]; i++) {
+        ngx_http_gunzip_request_pool_destroy(
+                                 &ngx_http_gunzip_request_encoders[i]->engine);
+    }
+
+#if (NGX_HTTP_GUNZIP_REQUEST_LIBDEFLATE)
+    if (ngx_http_gunzip_request_libdeflate) {
+        libdeflate_free_decompressor(ngx_http_gunzip_request_libdeflate);
+        ngx_http_gunzip_request_libdeflate = NULL;
+    }
+#endif
+}
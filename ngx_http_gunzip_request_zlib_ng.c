@@ -0,0 +1,120 @@
+
+/*
+ * zlib-ng native API engine.
+ *
+ * zlib-ng.h refuses to be included together with zlib.h, so this engine
+ * lives in its own translation unit.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include <zlib-ng.h>
+
+#include "ngx_http_gunzip_request_engine.h"
+
+
+static void *ngx_http_gunzip_request_zlib_ng_create(ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_zlib_ng_reset(void *data,
+    ngx_log_t *log);
+static ngx_int_t ngx_http_gunzip_request_zlib_ng_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log);
+static void ngx_http_gunzip_request_zlib_ng_destroy(void *data);
+
+
+ngx_http_gunzip_request_engine_t  ngx_http_gunzip_request_zlib_ng_engine = {
+    ngx_string("zlib-ng"),
+    ngx_http_gunzip_request_zlib_ng_create,
+    ngx_http_gunzip_request_zlib_ng_reset,
+    ngx_http_gunzip_request_zlib_ng_feed,
+    ngx_http_gunzip_request_zlib_ng_destroy,
+    { NULL, NULL },
+    0,
+    NULL
+};
+
+
+static void *
+ngx_http_gunzip_request_zlib_ng_create(ngx_log_t *log)
+{
+    int          rc;
+    zng_stream  *zs;
+
+    zs = ngx_calloc(sizeof(zng_stream), log);
+    if (zs == NULL) {
+        return NULL;
+    }
+
+    /* windowBits +16 to decode gzip */
+    rc = zng_inflateInit2(zs, MAX_WBITS + 16);
+
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "[gunzreq] zng_inflateInit2() failed: %d", rc);
+        ngx_free(zs);
+        return NULL;
+    }
+
+    return zs;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_zlib_ng_reset(void *data, ngx_log_t *log)
+{
+    int  rc;
+
+    rc = zng_inflateReset(data);
+
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "[gunzreq] zng_inflateReset() failed: %d", rc);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gunzip_request_zlib_ng_feed(void *data,
+    ngx_http_gunzip_request_io_t *io, ngx_uint_t flush, ngx_log_t *log)
+{
+    int          rc;
+    zng_stream  *zs = data;
+
+    zs->next_in = io->next_in;
+    zs->avail_in = io->avail_in;
+    zs->next_out = io->next_out;
+    zs->avail_out = io->avail_out;
+
+    rc = zng_inflate(zs, flush == NGX_HTTP_GUNZIP_REQUEST_FINISH ? Z_FINISH
+                         : flush == NGX_HTTP_GUNZIP_REQUEST_SYNC_FLUSH
+                         ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+
+    io->next_in = (u_char *) zs->next_in;
+    io->avail_in = zs->avail_in;
+    io->next_out = zs->next_out;
+    io->avail_out = zs->avail_out;
+
+    if (rc == Z_STREAM_END) {
+        return NGX_DONE;
+    }
+
+    if (rc != Z_OK && rc != Z_BUF_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "[gunzreq] zng_inflate() failed: %ui, %d", flush, rc);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gunzip_request_zlib_ng_destroy(void *data)
+{
+    (void) zng_inflateEnd(data);
+    ngx_free(data);
+}